@@ -0,0 +1,835 @@
+/*
+ * WineASIO Sample Format Conversion
+ * Copyright (C) 2024 WineASIO contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#if 0
+#pragma makedep unix
+#endif
+
+/*
+ * Conversion between JACK's float samples and the ASIO sample types, fused
+ * into the copy between JACK port buffers and the host's buffers.
+ *
+ * The scalar kernels are the reference. The SSE2 and AVX2 kernels must
+ * produce bit-identical results (tests/test_convert.c checks this), so
+ * they clip and round the same way:
+ *   - float -> int: scale by 2^(bits-1), clip to [-2^(bits-1), max] with
+ *     min-then-max (a NaN becomes max, as with MINPS), round to nearest
+ *   - int -> float: convert, then multiply by 1 / 2^(bits-1)
+ * The host runs on little-endian x86, so LSB types are stored natively
+ * and MSB types are byte-swapped (scalar only, no host uses them here).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "asio_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Largest value below full scale, as a float. 2^31 - 1 is not a float, so
+ * 32-bit samples clip at the largest float below 2^31. */
+static inline float clip_max(float scale)
+{
+    return scale >= 2147483648.0f ? 2147483520.0f : scale - 1.0f;
+}
+
+/* Round to nearest even, like CVTPS2DQ; lrintf may not be inlined */
+static inline int32_t round_nearest(float x)
+{
+#ifdef HAVE_X86_SIMD
+    return _mm_cvtss_si32(_mm_set_ss(x));
+#else
+    return (int32_t)lrintf(x);
+#endif
+}
+
+static inline int32_t float_to_int(float x, float scale, float max)
+{
+    x *= scale;
+    x = x < max ? x : max;
+    x = x > -scale ? x : -scale;
+    return round_nearest(x);
+}
+
+static inline uint32_t bswap32(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+static inline uint64_t bswap64(uint64_t v)
+{
+    return __builtin_bswap64(v);
+}
+
+/*
+ * Scalar reference kernels
+ *
+ * Every kernel takes the integer full-scale value so they share one
+ * signature; the float kernels ignore it.
+ */
+
+static void float32_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    (void)scale;
+    memcpy(dst, src, sizeof(float) * frames);
+}
+
+static void float32_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    (void)scale;
+    memcpy(dst, src, sizeof(float) * frames);
+}
+
+static void float32msb_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    uint32_t *out = dst;
+    unsigned int i;
+
+    (void)scale;
+    for (i = 0; i < frames; i++) {
+        uint32_t v;
+        memcpy(&v, &src[i], sizeof(v));
+        out[i] = bswap32(v);
+    }
+}
+
+static void float32msb_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const uint32_t *in = src;
+    unsigned int i;
+
+    (void)scale;
+    for (i = 0; i < frames; i++) {
+        uint32_t v = bswap32(in[i]);
+        memcpy(&dst[i], &v, sizeof(v));
+    }
+}
+
+/* Float64: widening is exact, narrowing rounds to nearest like CVTPD2PS */
+static void float64_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    double *out = dst;
+    unsigned int i;
+
+    (void)scale;
+    for (i = 0; i < frames; i++)
+        out[i] = src[i];
+}
+
+static void float64_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const double *in = src;
+    unsigned int i;
+
+    (void)scale;
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)in[i];
+}
+
+static void float64msb_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    uint64_t *out = dst;
+    unsigned int i;
+
+    (void)scale;
+    for (i = 0; i < frames; i++) {
+        double d = src[i];
+        uint64_t v;
+        memcpy(&v, &d, sizeof(v));
+        out[i] = bswap64(v);
+    }
+}
+
+static void float64msb_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const uint64_t *in = src;
+    unsigned int i;
+
+    (void)scale;
+    for (i = 0; i < frames; i++) {
+        uint64_t v = bswap64(in[i]);
+        double d;
+        memcpy(&d, &v, sizeof(d));
+        dst[i] = (float)d;
+    }
+}
+
+static void int16_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    int16_t *out = dst;
+    float max = clip_max(scale);
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        out[i] = (int16_t)float_to_int(src[i], scale, max);
+}
+
+static void int16_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const int16_t *in = src;
+    float inv = 1.0f / scale;
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)in[i] * inv;
+}
+
+static void int16msb_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    BYTE *out = dst;
+    float max = clip_max(scale);
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        int32_t v = float_to_int(src[i], scale, max);
+        out[2 * i] = (BYTE)(v >> 8);
+        out[2 * i + 1] = (BYTE)v;
+    }
+}
+
+static void int16msb_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const BYTE *in = src;
+    float inv = 1.0f / scale;
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)(int16_t)((in[2 * i] << 8) | in[2 * i + 1]) * inv;
+}
+
+static void int24_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    BYTE *out = dst;
+    float max = clip_max(scale);
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        int32_t v = float_to_int(src[i], scale, max);
+        out[3 * i] = (BYTE)v;
+        out[3 * i + 1] = (BYTE)(v >> 8);
+        out[3 * i + 2] = (BYTE)(v >> 16);
+    }
+}
+
+static inline int32_t read_int24(const BYTE *p)
+{
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+static void int24_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const BYTE *in = src;
+    float inv = 1.0f / scale;
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)read_int24(in + 3 * i) * inv;
+}
+
+static void int24msb_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    BYTE *out = dst;
+    float max = clip_max(scale);
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        int32_t v = float_to_int(src[i], scale, max);
+        out[3 * i] = (BYTE)(v >> 16);
+        out[3 * i + 1] = (BYTE)(v >> 8);
+        out[3 * i + 2] = (BYTE)v;
+    }
+}
+
+static void int24msb_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const BYTE *in = src;
+    float inv = 1.0f / scale;
+    unsigned int i;
+
+    for (i = 0; i < frames; i++) {
+        BYTE le[3] = { in[3 * i + 2], in[3 * i + 1], in[3 * i] };
+        dst[i] = (float)read_int24(le) * inv;
+    }
+}
+
+/* Int32 and the Int32LSB16/18/20/24 containers, which differ only in scale */
+static void int32_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    int32_t *out = dst;
+    float max = clip_max(scale);
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        out[i] = float_to_int(src[i], scale, max);
+}
+
+static void int32_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const int32_t *in = src;
+    float inv = 1.0f / scale;
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)in[i] * inv;
+}
+
+static void int32msb_to_host(void *dst, const float *src, unsigned int frames, float scale)
+{
+    uint32_t *out = dst;
+    float max = clip_max(scale);
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        out[i] = bswap32((uint32_t)float_to_int(src[i], scale, max));
+}
+
+static void int32msb_from_host(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const uint32_t *in = src;
+    float inv = 1.0f / scale;
+    unsigned int i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (float)(int32_t)bswap32(in[i]) * inv;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * SSE2 kernels - SSE2 is part of x86_64, so these need no target attribute
+ */
+
+static inline __m128i clip_round_sse2(__m128 x, __m128 s, __m128 hi, __m128 lo)
+{
+    x = _mm_mul_ps(x, s);
+    x = _mm_max_ps(_mm_min_ps(x, hi), lo);
+    return _mm_cvtps_epi32(x);
+}
+
+static void int16_to_host_sse2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    int16_t *out = dst;
+    __m128 s = _mm_set1_ps(scale), hi = _mm_set1_ps(clip_max(scale)), lo = _mm_set1_ps(-scale);
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = clip_round_sse2(_mm_loadu_ps(src + i), s, hi, lo);
+        __m128i b = clip_round_sse2(_mm_loadu_ps(src + i + 4), s, hi, lo);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+    }
+    int16_to_host(out + i, src + i, frames - i, scale);
+}
+
+static void int16_from_host_sse2(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const int16_t *in = src;
+    __m128 inv = _mm_set1_ps(1.0f / scale);
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), inv));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), inv));
+    }
+    int16_from_host(dst + i, in + i, frames - i, scale);
+}
+
+static void int24_to_host_sse2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    BYTE *out = dst;
+    __m128 s = _mm_set1_ps(scale), hi = _mm_set1_ps(clip_max(scale)), lo = _mm_set1_ps(-scale);
+    int32_t tmp[4];
+    unsigned int i = 0, j;
+
+    /* Convert four at a time, then pack to three bytes each */
+    for (; i + 4 <= frames; i += 4) {
+        _mm_storeu_si128((__m128i *)tmp, clip_round_sse2(_mm_loadu_ps(src + i), s, hi, lo));
+        for (j = 0; j < 4; j++) {
+            out[3 * (i + j)] = (BYTE)tmp[j];
+            out[3 * (i + j) + 1] = (BYTE)(tmp[j] >> 8);
+            out[3 * (i + j) + 2] = (BYTE)(tmp[j] >> 16);
+        }
+    }
+    int24_to_host(out + 3 * i, src + i, frames - i, scale);
+}
+
+static void int32_to_host_sse2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    int32_t *out = dst;
+    __m128 s = _mm_set1_ps(scale), hi = _mm_set1_ps(clip_max(scale)), lo = _mm_set1_ps(-scale);
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+        _mm_storeu_si128((__m128i *)(out + i), clip_round_sse2(_mm_loadu_ps(src + i), s, hi, lo));
+    int32_to_host(out + i, src + i, frames - i, scale);
+}
+
+static void int32_from_host_sse2(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const int32_t *in = src;
+    __m128 inv = _mm_set1_ps(1.0f / scale);
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), inv));
+    }
+    int32_from_host(dst + i, in + i, frames - i, scale);
+}
+
+static void float64_to_host_sse2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    double *out = dst;
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4) {
+        __m128 x = _mm_loadu_ps(src + i);
+        _mm_storeu_pd(out + i, _mm_cvtps_pd(x));
+        _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+    }
+    float64_to_host(out + i, src + i, frames - i, scale);
+}
+
+static void float64_from_host_sse2(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const double *in = src;
+    unsigned int i = 0;
+
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+        __m128 b = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(a, b));
+    }
+    float64_from_host(dst + i, in + i, frames - i, scale);
+}
+
+/*
+ * AVX2 kernels - selected only if the CPU reports AVX2. GCC does not clear
+ * the upper halves before the tail call into the SSE2/scalar kernels, so
+ * that is done explicitly to avoid an AVX-SSE transition penalty.
+ */
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i clip_round_avx2(__m256 x, __m256 s, __m256 hi, __m256 lo)
+{
+    x = _mm256_mul_ps(x, s);
+    x = _mm256_max_ps(_mm256_min_ps(x, hi), lo);
+    return _mm256_cvtps_epi32(x);
+}
+
+static AVX2 void int16_to_host_avx2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    int16_t *out = dst;
+    __m256 s = _mm256_set1_ps(scale), hi = _mm256_set1_ps(clip_max(scale)), lo = _mm256_set1_ps(-scale);
+    unsigned int i = 0;
+
+    for (; i + 16 <= frames; i += 16) {
+        __m256i a = clip_round_avx2(_mm256_loadu_ps(src + i), s, hi, lo);
+        __m256i b = clip_round_avx2(_mm256_loadu_ps(src + i + 8), s, hi, lo);
+        /* packs works per 128-bit lane - restore sample order */
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+        _mm256_storeu_si256((__m256i *)(out + i), p);
+    }
+    _mm256_zeroupper();
+    int16_to_host_sse2(out + i, src + i, frames - i, scale);
+}
+
+static AVX2 void int16_from_host_avx2(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const int16_t *in = src;
+    __m256 inv = _mm256_set1_ps(1.0f / scale);
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), inv));
+    }
+    _mm256_zeroupper();
+    int16_from_host(dst + i, in + i, frames - i, scale);
+}
+
+static AVX2 void int24_to_host_avx2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    BYTE *out = dst;
+    __m256 s = _mm256_set1_ps(scale), hi = _mm256_set1_ps(clip_max(scale)), lo = _mm256_set1_ps(-scale);
+    int32_t tmp[8];
+    unsigned int i = 0, j;
+
+    for (; i + 8 <= frames; i += 8) {
+        _mm256_storeu_si256((__m256i *)tmp, clip_round_avx2(_mm256_loadu_ps(src + i), s, hi, lo));
+        for (j = 0; j < 8; j++) {
+            out[3 * (i + j)] = (BYTE)tmp[j];
+            out[3 * (i + j) + 1] = (BYTE)(tmp[j] >> 8);
+            out[3 * (i + j) + 2] = (BYTE)(tmp[j] >> 16);
+        }
+    }
+    _mm256_zeroupper();
+    int24_to_host(out + 3 * i, src + i, frames - i, scale);
+}
+
+static AVX2 void int32_to_host_avx2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    int32_t *out = dst;
+    __m256 s = _mm256_set1_ps(scale), hi = _mm256_set1_ps(clip_max(scale)), lo = _mm256_set1_ps(-scale);
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8)
+        _mm256_storeu_si256((__m256i *)(out + i), clip_round_avx2(_mm256_loadu_ps(src + i), s, hi, lo));
+    _mm256_zeroupper();
+    int32_to_host(out + i, src + i, frames - i, scale);
+}
+
+static AVX2 void int32_from_host_avx2(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const int32_t *in = src;
+    __m256 inv = _mm256_set1_ps(1.0f / scale);
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), inv));
+    }
+    _mm256_zeroupper();
+    int32_from_host(dst + i, in + i, frames - i, scale);
+}
+
+static AVX2 void float64_to_host_avx2(void *dst, const float *src, unsigned int frames, float scale)
+{
+    double *out = dst;
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        _mm256_storeu_pd(out + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+        _mm256_storeu_pd(out + i + 4, _mm256_cvtps_pd(_mm_loadu_ps(src + i + 4)));
+    }
+    _mm256_zeroupper();
+    float64_to_host_sse2(out + i, src + i, frames - i, scale);
+}
+
+static AVX2 void float64_from_host_avx2(float *dst, const void *src, unsigned int frames, float scale)
+{
+    const double *in = src;
+    unsigned int i = 0;
+
+    for (; i + 8 <= frames; i += 8) {
+        __m128 a = _mm256_cvtpd_ps(_mm256_loadu_pd(in + i));
+        __m128 b = _mm256_cvtpd_ps(_mm256_loadu_pd(in + i + 4));
+        _mm256_storeu_ps(dst + i, _mm256_set_m128(b, a));
+    }
+    _mm256_zeroupper();
+    float64_from_host_sse2(dst + i, in + i, frames - i, scale);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/*
+ * Dither
+ *
+ * Eight independent xorshift32 generators, one per lane, so the noise can
+ * be produced a vector at a time. Each 32-bit draw gives both uniform
+ * values of a TPDF sample: (low 16 bits - high 16 bits) / 65536. All
+ * steps are exact, so the SIMD generators match the scalar one.
+ */
+
+#define DITHER_BLOCK 64     /* Samples converted per pass, a multiple of 8 */
+
+static inline uint32_t xorshift32(uint32_t s)
+{
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
+
+static void tpdf_noise(uint32_t *rng, float *noise, unsigned int frames)
+{
+    unsigned int i, l;
+
+    for (i = 0; i < frames; i += 8) {
+        for (l = 0; l < 8; l++) {
+            uint32_t s = rng[l] = xorshift32(rng[l]);
+            noise[i + l] = (float)((int32_t)(s & 0xffff) - (int32_t)(s >> 16)) * (1.0f / 65536.0f);
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+static inline __m128i xorshift32_sse2(__m128i s)
+{
+    s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+    s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+    return _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+}
+
+static inline __m128 tpdf_sse2(__m128i s)
+{
+    __m128i lo = _mm_and_si128(s, _mm_set1_epi32(0xffff));
+    __m128i hi = _mm_srli_epi32(s, 16);
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(lo, hi)), _mm_set1_ps(1.0f / 65536.0f));
+}
+
+static void tpdf_noise_sse2(uint32_t *rng, float *noise, unsigned int frames)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)rng);
+    __m128i b = _mm_loadu_si128((const __m128i *)(rng + 4));
+    unsigned int i;
+
+    for (i = 0; i < frames; i += 8) {
+        a = xorshift32_sse2(a);
+        b = xorshift32_sse2(b);
+        _mm_storeu_ps(noise + i, tpdf_sse2(a));
+        _mm_storeu_ps(noise + i + 4, tpdf_sse2(b));
+    }
+    _mm_storeu_si128((__m128i *)rng, a);
+    _mm_storeu_si128((__m128i *)(rng + 4), b);
+}
+
+static AVX2 void tpdf_noise_avx2(uint32_t *rng, float *noise, unsigned int frames)
+{
+    __m256i s = _mm256_loadu_si256((const __m256i *)rng);
+    __m256i mask = _mm256_set1_epi32(0xffff);
+    __m256 unit = _mm256_set1_ps(1.0f / 65536.0f);
+    unsigned int i;
+
+    for (i = 0; i < frames; i += 8) {
+        s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+        s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+        s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+        __m256i d = _mm256_sub_epi32(_mm256_and_si256(s, mask), _mm256_srli_epi32(s, 16));
+        _mm256_storeu_ps(noise + i, _mm256_mul_ps(_mm256_cvtepi32_ps(d), unit));
+    }
+    _mm256_storeu_si256((__m256i *)rng, s);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+void asio_dither_init(struct asio_dither *dither, unsigned int seed)
+{
+    uint64_t x = seed;
+    int l;
+
+    /* splitmix64 spreads nearby seeds; xorshift32 must not start at 0 */
+    for (l = 0; l < 8; l++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z ^= z >> 31;
+        dither->rng[l] = (uint32_t)z ? (uint32_t)z : 0x6d2b79f5;
+    }
+    dither->error = 0.0f;
+}
+
+LONG asio_converter_set_dither(struct asio_converter *conv, LONG mode)
+{
+    if (mode != WINEASIO_DITHER_TPDF && mode != WINEASIO_DITHER_SHAPED)
+        mode = WINEASIO_DITHER_NONE;
+    /* Float types have scale 1; above 24 bits one LSB is below float precision */
+    if (conv->scale <= 1.0f || conv->scale > 8388608.0f)
+        mode = WINEASIO_DITHER_NONE;
+    conv->dither = mode;
+    return mode;
+}
+
+void asio_to_host_dithered(const struct asio_converter *conv, struct asio_dither *dither,
+                           void *dst, const float *src, unsigned int frames)
+{
+    float noise[DITHER_BLOCK], tmp[DITHER_BLOCK];
+    float scale = conv->scale, inv = 1.0f / scale, max = clip_max(scale);
+    BYTE *out = dst;
+    unsigned int i, n;
+
+    if (conv->dither == WINEASIO_DITHER_NONE) {
+        conv->to_host(dst, src, frames, scale);
+        return;
+    }
+
+    while (frames) {
+        n = frames < DITHER_BLOCK ? frames : DITHER_BLOCK;
+        conv->noise(dither->rng, noise, DITHER_BLOCK);
+
+        if (conv->dither == WINEASIO_DITHER_SHAPED) {
+            /* First-order error feedback: the quantization error of each
+             * sample is subtracted from the next, moving it up in frequency.
+             * The loop quantizes itself; q / scale is exact for a power of
+             * two scale, so to_host only clips and packs. The input is
+             * clipped first, which keeps the error within 1.5 LSB and off
+             * the serial error path. */
+            float err = dither->error;
+
+            for (i = 0; i < n; i++) {
+                float x = src[i] * scale;
+                x = x < max ? x : max;
+                tmp[i] = x > -scale ? x : -scale;
+            }
+            for (i = 0; i < n; i++) {
+                float v = tmp[i] - err;
+                float q = (float)round_nearest(v + noise[i]);
+                err = q - v;
+                tmp[i] = q * inv;
+            }
+            dither->error = err;
+        } else {
+            for (i = 0; i < n; i++)
+                tmp[i] = src[i] + noise[i] * inv;
+        }
+
+        conv->to_host(out, tmp, n, scale);
+        out += (size_t)n * conv->sample_size;
+        src += n;
+        frames -= n;
+    }
+}
+
+enum asio_simd_level asio_simd_detect(void)
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ASIO_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return ASIO_SIMD_SSE2;
+#endif
+    return ASIO_SIMD_SCALAR;
+}
+
+const char *asio_simd_name(enum asio_simd_level level)
+{
+    switch (level) {
+    case ASIO_SIMD_AVX2: return "AVX2";
+    case ASIO_SIMD_SSE2: return "SSE2";
+    default:             return "scalar";
+    }
+}
+
+/* One row per sample type: scalar kernels, then SSE2 and AVX2 overrides
+ * (NULL where the scalar kernel is used at that level) */
+struct kernel_set {
+    ASIOSampleType type;
+    int bits;
+    asio_to_host_fn to_host[3];
+    asio_from_host_fn from_host[3];
+};
+
+#ifdef HAVE_X86_SIMD
+#define SIMD(sse2, avx2) sse2, avx2
+#else
+#define SIMD(sse2, avx2) NULL, NULL
+#endif
+
+static const struct kernel_set kernels[] = {
+    { ASIOSTFloat32LSB, 0,  { float32_to_host, NULL, NULL },
+                            { float32_from_host, NULL, NULL } },
+    { ASIOSTFloat64LSB, 0,  { float64_to_host, SIMD(float64_to_host_sse2, float64_to_host_avx2) },
+                            { float64_from_host, SIMD(float64_from_host_sse2, float64_from_host_avx2) } },
+    { ASIOSTInt16LSB,   16, { int16_to_host, SIMD(int16_to_host_sse2, int16_to_host_avx2) },
+                            { int16_from_host, SIMD(int16_from_host_sse2, int16_from_host_avx2) } },
+    { ASIOSTInt24LSB,   24, { int24_to_host, SIMD(int24_to_host_sse2, int24_to_host_avx2) },
+                            { int24_from_host, NULL, NULL } },
+    { ASIOSTInt32LSB,   32, { int32_to_host, SIMD(int32_to_host_sse2, int32_to_host_avx2) },
+                            { int32_from_host, SIMD(int32_from_host_sse2, int32_from_host_avx2) } },
+    { ASIOSTInt32LSB16, 16, { int32_to_host, SIMD(int32_to_host_sse2, int32_to_host_avx2) },
+                            { int32_from_host, SIMD(int32_from_host_sse2, int32_from_host_avx2) } },
+    { ASIOSTInt32LSB18, 18, { int32_to_host, SIMD(int32_to_host_sse2, int32_to_host_avx2) },
+                            { int32_from_host, SIMD(int32_from_host_sse2, int32_from_host_avx2) } },
+    { ASIOSTInt32LSB20, 20, { int32_to_host, SIMD(int32_to_host_sse2, int32_to_host_avx2) },
+                            { int32_from_host, SIMD(int32_from_host_sse2, int32_from_host_avx2) } },
+    { ASIOSTInt32LSB24, 24, { int32_to_host, SIMD(int32_to_host_sse2, int32_to_host_avx2) },
+                            { int32_from_host, SIMD(int32_from_host_sse2, int32_from_host_avx2) } },
+    { ASIOSTFloat32MSB, 0,  { float32msb_to_host, NULL, NULL },
+                            { float32msb_from_host, NULL, NULL } },
+    { ASIOSTFloat64MSB, 0,  { float64msb_to_host, NULL, NULL },
+                            { float64msb_from_host, NULL, NULL } },
+    { ASIOSTInt16MSB,   16, { int16msb_to_host, NULL, NULL },
+                            { int16msb_from_host, NULL, NULL } },
+    { ASIOSTInt24MSB,   24, { int24msb_to_host, NULL, NULL },
+                            { int24msb_from_host, NULL, NULL } },
+    { ASIOSTInt32MSB,   32, { int32msb_to_host, NULL, NULL },
+                            { int32msb_from_host, NULL, NULL } },
+    { ASIOSTInt32MSB16, 16, { int32msb_to_host, NULL, NULL },
+                            { int32msb_from_host, NULL, NULL } },
+    { ASIOSTInt32MSB18, 18, { int32msb_to_host, NULL, NULL },
+                            { int32msb_from_host, NULL, NULL } },
+    { ASIOSTInt32MSB20, 20, { int32msb_to_host, NULL, NULL },
+                            { int32msb_from_host, NULL, NULL } },
+    { ASIOSTInt32MSB24, 24, { int32msb_to_host, NULL, NULL },
+                            { int32msb_from_host, NULL, NULL } },
+};
+
+BOOL asio_converter_init(struct asio_converter *conv, ASIOSampleType type, enum asio_simd_level level)
+{
+    enum asio_simd_level cpu = asio_simd_detect();
+    unsigned int i;
+    int l;
+
+    if (level > cpu)
+        level = cpu;
+
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        const struct kernel_set *k = &kernels[i];
+
+        if (k->type != type)
+            continue;
+
+        conv->type = type;
+        conv->sample_size = asio_sample_size(type);
+        conv->scale = k->bits ? (float)(1u << (k->bits - 1)) : 1.0f;
+        conv->level = ASIO_SIMD_SCALAR;
+        conv->to_host = k->to_host[0];
+        conv->from_host = k->from_host[0];
+        conv->dither = WINEASIO_DITHER_NONE;
+        conv->noise = tpdf_noise;
+#ifdef HAVE_X86_SIMD
+        if (level >= ASIO_SIMD_AVX2)
+            conv->noise = tpdf_noise_avx2;
+        else if (level >= ASIO_SIMD_SSE2)
+            conv->noise = tpdf_noise_sse2;
+#endif
+
+        /* Use the best kernel at or below the requested level */
+        for (l = level; l > ASIO_SIMD_SCALAR; l--) {
+            if (k->to_host[l] || k->from_host[l]) {
+                conv->level = l;
+                break;
+            }
+        }
+        for (l = level; l > ASIO_SIMD_SCALAR; l--) {
+            if (k->to_host[l]) {
+                conv->to_host = k->to_host[l];
+                break;
+            }
+        }
+        for (l = level; l > ASIO_SIMD_SCALAR; l--) {
+            if (k->from_host[l]) {
+                conv->from_host = k->from_host[l];
+                break;
+            }
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,78 @@
+/*
+ * WineASIO Sample Format Conversion
+ * Copyright (C) 2024 WineASIO contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINEASIO_CONVERT_H
+#define __WINEASIO_CONVERT_H
+
+#include <stdint.h>
+
+#include "unixlib.h"
+
+/* Instruction set used by the conversion kernels */
+enum asio_simd_level {
+    ASIO_SIMD_SCALAR = 0,
+    ASIO_SIMD_SSE2,
+    ASIO_SIMD_AVX2,
+};
+
+/* Kernels convert while copying between a JACK port buffer (float) and a
+ * host buffer in the stream's ASIO sample type. scale is the converter's
+ * full-scale value (2^(bits-1) for integer formats). */
+typedef void (*asio_to_host_fn)(void *dst, const float *src, unsigned int frames, float scale);
+typedef void (*asio_from_host_fn)(float *dst, const void *src, unsigned int frames, float scale);
+
+/* Fills frames (a multiple of 8) TPDF samples in LSBs, range (-1, 1) */
+typedef void (*asio_noise_fn)(uint32_t *rng, float *noise, unsigned int frames);
+
+/* Per-channel dither state */
+struct asio_dither {
+    uint32_t rng[8];        /* xorshift32 state, one per vector lane */
+    float error;            /* Last quantization error in LSBs, for noise shaping */
+};
+
+struct asio_converter {
+    ASIOSampleType type;
+    unsigned int sample_size;
+    float scale;
+    enum asio_simd_level level;
+    asio_to_host_fn to_host;        /* Capture: JACK float -> host format, clipped */
+    asio_from_host_fn from_host;    /* Playback: host format -> JACK float */
+    LONG dither;                    /* WINEASIO_DITHER_*, applied by asio_to_host_dithered */
+    asio_noise_fn noise;
+};
+
+/* Best instruction set the CPU supports */
+enum asio_simd_level asio_simd_detect(void);
+const char *asio_simd_name(enum asio_simd_level level);
+
+/* Select the kernels for a sample type, using at most the given level
+ * (capped at what the CPU supports). Returns FALSE for unsupported types. */
+BOOL asio_converter_init(struct asio_converter *conv, ASIOSampleType type, enum asio_simd_level level);
+
+/* Enable dither for the converter's type. Types with more than 24 bits or
+ * float types are not dithered. Returns the effective mode. */
+LONG asio_converter_set_dither(struct asio_converter *conv, LONG mode);
+
+void asio_dither_init(struct asio_dither *dither, unsigned int seed);
+
+/* to_host with the converter's dither mode, using per-channel state */
+void asio_to_host_dithered(const struct asio_converter *conv, struct asio_dither *dither,
+                           void *dst, const float *src, unsigned int frames);
+
+#endif /* __WINEASIO_CONVERT_H */
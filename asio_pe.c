@@ -315,6 +315,7 @@ struct IWineASIO {
     ASIOCallbacks *callbacks;
     BOOL time_info_mode;
     BOOL can_time_code;
+    BOOL can_report_overload;
     
     /* State */
     LONG num_inputs;
@@ -326,15 +327,27 @@ struct IWineASIO {
     HANDLE callback_thread;
     BOOL stop_callback_thread;
     ASIOTime host_time;
+    LONG switch_index;          /* Buffer switch the host is processing, for OutputReady */
+    INT64 switch_position;
+    DWORD denormal_callbacks;   /* Buffer switches in which the host's DSP hit denormals */
     
     /* Configuration */
     struct asio_config config;
     
+    /* Status block written by the Unix side every JACK cycle */
+    struct asio_status *status;
+    
+    /* Stream description cache, see describe_stream */
+    struct asio_describe_stream_params desc;
+    struct asio_channel_info *channel_infos;
+    BOOL desc_valid;
+    
     /* PE-side audio buffers (Wine 11 WoW64 fix)
      * In Wine 11 WoW64, Unix side runs in 64-bit address space while
      * 32-bit PE code runs in emulated 32-bit space. Buffers must be
      * allocated on PE side to be accessible by 32-bit Windows code. */
-    void *pe_audio_buffers;     /* Block of all audio buffers */
+    void *pe_audio_buffers;     /* Buffer arena, see CreateBuffers */
+    SIZE_T pe_arena_size;
     LONG pe_num_buffers;        /* Number of channels */
     LONG pe_buffer_size;        /* Samples per buffer */
 };
@@ -346,6 +359,81 @@ static const GUID CLSID_WineASIO = {
 
 #define UNIX_CALL(func, params) wine_unix_call(wineasio_unix_handle, unix_##func, params)
 
+/* How long the callback thread blocks in the Unix side before re-checking
+ * stop_callback_thread. Stop() also wakes it explicitly via asio_stop. */
+#define CALLBACK_WAIT_TIMEOUT 100  /* ms */
+
+/* Seqlock retries before read_status gives up and callers use a unix call */
+#define STATUS_READ_TRIES 64
+
+/* Copy a consistent snapshot of the status block. Lock-free, so any number
+ * of host threads can read it at once. */
+static BOOL read_status(IWineASIO *This, struct asio_status *snap)
+{
+    const volatile struct asio_status *status = This->status;
+    UINT32 seq;
+    int i;
+    
+    if (!status)
+        return FALSE;
+    
+    for (i = 0; i < STATUS_READ_TRIES; i++) {
+        seq = __atomic_load_n(&status->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            YieldProcessor();
+            continue;
+        }
+        
+        snap->buffer_index = status->buffer_index;
+        snap->sample_position = status->sample_position;
+        snap->system_time = status->system_time;
+        snap->sample_rate = status->sample_rate;
+        snap->host_overruns = status->host_overruns;
+        snap->jack_xruns = status->jack_xruns;
+        snap->load = status->load;
+        snap->lock_failures = status->lock_failures;
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&status->seq, __ATOMIC_RELAXED) == seq)
+            return seq != 0;  /* 0: never published */
+    }
+    
+    return FALSE;
+}
+
+/* Fill the description cache with one unix call if it is missing or the
+ * Unix side reported a reset, rate or latency change since */
+static BOOL describe_stream(IWineASIO *This)
+{
+    LONG count = This->num_inputs + This->num_outputs;
+    
+    if (This->desc_valid && This->status &&
+        This->desc.describe_gen == __atomic_load_n(&This->status->describe_gen, __ATOMIC_ACQUIRE))
+        return TRUE;
+    
+    if (!This->channel_infos && count > 0)
+        This->channel_infos = HeapAlloc(GetProcessHeap(), 0, count * sizeof(*This->channel_infos));
+    
+    memset(&This->desc, 0, sizeof(This->desc));
+    This->desc.handle = This->handle;
+    if (This->channel_infos) {
+        This->desc.num_channel_infos = count;
+        This->desc.channel_infos = (UINT64)(UINT_PTR)This->channel_infos;
+    }
+    UNIX_CALL(asio_describe_stream, &This->desc);
+    
+    This->desc_valid = This->desc.result == ASE_OK && This->desc.num_channel_infos;
+    if (!This->desc_valid && This->desc.result == ASE_OK)
+        This->desc.result = ASE_NoMemory;
+    return This->desc_valid;
+}
+
+/* Changes made through the driver itself (buffers, sample rate) */
+static void invalidate_description(IWineASIO *This)
+{
+    This->desc_valid = FALSE;
+}
+
 /* Read configuration from registry */
 static void read_config(IWineASIO *This)
 {
@@ -359,6 +447,25 @@ static void read_config(IWineASIO *This)
     This->config.preferred_bufsize = 1024;
     This->config.fixed_bufsize = FALSE;
     This->config.autoconnect = TRUE;
+    This->config.callback_spin = 0;
+    This->config.process_mode = WINEASIO_PROCESS_ASYNC;
+    This->config.sync_deadline = 90;
+    This->config.callback_policy = WINEASIO_SCHED_FIFO;
+    This->config.callback_priority = 0;
+    This->config.pin_jack_thread = FALSE;
+    This->config.safety_periods = 0;
+    This->config.sample_type = ASIOSTFloat32LSB;
+    This->config.dither = WINEASIO_DITHER_NONE;
+    This->config.denormal_protect = TRUE;
+    This->config.page_align_buffers = FALSE;
+    This->config.unix_buffers = TRUE;
+    This->config.huge_pages = WINEASIO_HUGE_PAGES_TRANSPARENT;
+    This->config.lock_memory = TRUE;
+    This->config.lazy_ports = FALSE;
+    This->config.keep_alive = 0;
+    This->config.max_bufsize = 0;
+    This->config.cpu_set[0] = '\0';
+    memset(This->config.routing, 0, sizeof(This->config.routing));
     strcpy(This->config.client_name, "WineASIO");
     
     if (RegOpenKeyExA(HKEY_CURRENT_USER, "Software\\Wine\\WineASIO", 0, KEY_READ, &hkey) == ERROR_SUCCESS) {
@@ -382,78 +489,380 @@ static void read_config(IWineASIO *This)
         if (RegQueryValueExA(hkey, "Connect to hardware", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
             This->config.autoconnect = value ? TRUE : FALSE;
         
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Callback spin time", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.callback_spin = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Process mode", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.process_mode = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Sync deadline", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.sync_deadline = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Safety periods", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.safety_periods = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Sample type", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.sample_type = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Dither", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.dither = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Denormal protection", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.denormal_protect = value ? TRUE : FALSE;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Page aligned buffers", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.page_align_buffers = value ? TRUE : FALSE;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Unix buffers", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.unix_buffers = value ? TRUE : FALSE;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Huge pages", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.huge_pages = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Lock memory", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.lock_memory = value ? TRUE : FALSE;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Lazy ports", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.lazy_ports = value ? TRUE : FALSE;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Keep alive", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.keep_alive = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Max buffersize", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.max_bufsize = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Callback policy", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.callback_policy = value;
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Callback priority", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.callback_priority = value;
+        
         size = sizeof(str_value);
         if (RegQueryValueExA(hkey, "Client name", NULL, &type, (BYTE*)str_value, &size) == ERROR_SUCCESS && type == REG_SZ)
             strncpy(This->config.client_name, str_value, 63);
         
+        size = sizeof(str_value);
+        if (RegQueryValueExA(hkey, "Callback CPU set", NULL, &type, (BYTE*)str_value, &size) == ERROR_SUCCESS && type == REG_SZ)
+            strncpy(This->config.cpu_set, str_value, 63);
+        
+        size = sizeof(This->config.routing) - 1;
+        if (RegQueryValueExA(hkey, "Routing map", NULL, &type, (BYTE*)This->config.routing, &size) != ERROR_SUCCESS ||
+            type != REG_SZ)
+            memset(This->config.routing, 0, sizeof(This->config.routing));
+        
+        size = sizeof(value);
+        if (RegQueryValueExA(hkey, "Pin JACK thread", NULL, &type, (BYTE*)&value, &size) == ERROR_SUCCESS && type == REG_DWORD)
+            This->config.pin_jack_thread = value ? TRUE : FALSE;
+        
         RegCloseKey(hkey);
     }
     
-    TRACE("Config: inputs=%d outputs=%d bufsize=%d fixed=%d autoconnect=%d name=%s\n",
+    TRACE("Config: inputs=%d outputs=%d bufsize=%d fixed=%d autoconnect=%d spin=%dus mode=%d deadline=%d%% safety=%d "
+          "type=%d dither=%d denormal=%d policy=%d priority=%d cpus='%s' pin_jack=%d name=%s\n",
           This->config.num_inputs, This->config.num_outputs, This->config.preferred_bufsize,
-          This->config.fixed_bufsize, This->config.autoconnect, This->config.client_name);
+          This->config.fixed_bufsize, This->config.autoconnect, This->config.callback_spin,
+          This->config.process_mode, This->config.sync_deadline, This->config.safety_periods,
+          This->config.sample_type, This->config.dither, This->config.denormal_protect,
+          This->config.callback_policy,
+          This->config.callback_priority, This->config.cpu_set, This->config.pin_jack_thread,
+          This->config.client_name);
 }
 
-/* Callback polling thread - polls Unix side for buffer switches */
+/* Deliver the events reported by the Unix side to the host, in order.
+ * Only the newest buffer switch of a batch is delivered - older ones refer
+ * to buffers JACK has already played. Returns the delivered buffer switch,
+ * or NULL if the batch held none. */
+static const struct asio_event *dispatch_callback(IWineASIO *This, const struct asio_get_callback_params *params)
+{
+    const struct asio_event *bswitch = NULL;
+    BOOL overload = FALSE;
+    LONG i;
+    
+    for (i = 0; i < params->num_events; i++) {
+        const struct asio_event *event = &params->events[i];
+        
+        switch (event->type) {
+        case ASIO_EVENT_BUFFER_SWITCH:
+            bswitch = event;
+            break;
+            
+        case ASIO_EVENT_SAMPLE_RATE:
+            TRACE("Sample rate changed to %f\n", event->value);
+            This->sample_rate = event->value;
+            This->callbacks->sampleRateDidChange(event->value);
+            break;
+            
+        case ASIO_EVENT_BUFFER_SIZE:
+            /* The buffers hold the new period - hosts that support it
+             * switch in place, the others get a reset request */
+            if (This->callbacks->asioMessage(kAsioSelectorSupported, kAsioBufferSizeChange, NULL, NULL) == 1 &&
+                This->callbacks->asioMessage(kAsioBufferSizeChange, (LONG)event->value, NULL, NULL) == 1) {
+                TRACE("Buffer size changed in place to %d\n", (int)event->value);
+                This->buffer_size = (LONG)event->value;
+                break;
+            }
+            /* Fall through */
+        case ASIO_EVENT_RESET:
+            TRACE("Reset requested (buffer size %d)\n", (int)event->value);
+            This->callbacks->asioMessage(kAsioSelectorSupported, kAsioResetRequest, NULL, NULL);
+            This->callbacks->asioMessage(kAsioResetRequest, 0, NULL, NULL);
+            break;
+            
+        case ASIO_EVENT_LATENCY:
+            TRACE("Latency changed\n");
+            This->callbacks->asioMessage(kAsioSelectorSupported, kAsioLatenciesChanged, NULL, NULL);
+            This->callbacks->asioMessage(kAsioLatenciesChanged, 0, NULL, NULL);
+            break;
+            
+        case ASIO_EVENT_XRUN:
+            TRACE("JACK xrun (%.0f us)\n", event->value);
+            overload = TRUE;
+            break;
+            
+        case ASIO_EVENT_HOST_OVERRUN:
+            overload = TRUE;
+            break;
+            
+        default:
+            break;
+        }
+    }
+    
+    /* One message per batch, however many dropouts it reports */
+    if (overload && This->can_report_overload)
+        This->callbacks->asioMessage(kAsioOverload, 0, NULL, NULL);
+    
+    if (!bswitch)
+        return NULL;
+    
+    This->switch_index = bswitch->buffer_index;
+    This->switch_position = bswitch->sample_position;
+    
+    /* Buffer switch - no debug logging in hot path to avoid xruns */
+    if (This->time_info_mode) {
+        /* Use time info mode */
+        This->host_time.timeInfo.hi = (LONG)(bswitch->sample_position >> 32);
+        This->host_time.timeInfo.lo = (LONG)(bswitch->sample_position & 0xFFFFFFFF);
+        This->host_time.systemTime.hi = (LONG)(bswitch->system_time >> 32);
+        This->host_time.systemTime.lo = (LONG)(bswitch->system_time & 0xFFFFFFFF);
+        This->host_time.sampleRate = bswitch->value;
+        This->host_time.flags = 0x7;  /* System time, sample position and rate valid */
+        
+        This->callbacks->bufferSwitchTimeInfo(&This->host_time, bswitch->buffer_index, TRUE);
+    } else {
+        /* Use simple buffer switch */
+        This->callbacks->bufferSwitch(bswitch->buffer_index, TRUE);
+    }
+    
+    return bswitch;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static inline unsigned int get_mxcsr(void)
+{
+    unsigned int csr;
+    __asm__ __volatile__("stmxcsr %0" : "=m"(csr));
+    return csr;
+}
+
+static inline void set_mxcsr(unsigned int csr)
+{
+    __asm__ __volatile__("ldmxcsr %0" : : "m"(csr));
+}
+#else
+static inline unsigned int get_mxcsr(void) { return 0; }
+static inline void set_mxcsr(unsigned int csr) { }
+#endif
+
+/* Flush denormals to zero in the host's DSP on the calling callback
+ * thread. Only SSE math is affected - x87 code has no such mode. */
+static void set_denormal_mode(IWineASIO *This)
+{
+    if (!This->config.denormal_protect)
+        return;
+    set_mxcsr(get_mxcsr() | WINEASIO_MXCSR_FTZ | WINEASIO_MXCSR_DAZ);
+    TRACE("Callback thread flushes denormals to zero\n");
+}
+
+/* Count buffer switches whose processing took the slow denormal path:
+ * a denormal operand (DE) or, without protection, a denormal result (UE).
+ * FTZ still raises UE when it flushes a tiny result, at no cost, so with
+ * protection on only DE counts - and DAZ keeps that clear too, so the count
+ * mainly shows what turning protection off costs. The flags are sticky and
+ * cleared per switch. */
+static inline void check_denormals(IWineASIO *This)
+{
+    unsigned int slow = This->config.denormal_protect ? WINEASIO_MXCSR_DE
+                                                      : WINEASIO_MXCSR_DE | WINEASIO_MXCSR_UE;
+    unsigned int csr = get_mxcsr();
+
+    if (csr & slow)
+        This->denormal_callbacks++;
+    if (csr & (WINEASIO_MXCSR_DE | WINEASIO_MXCSR_UE))
+        set_mxcsr(csr & ~(WINEASIO_MXCSR_DE | WINEASIO_MXCSR_UE));
+}
+
+/* Raise the calling callback thread to realtime scheduling. If the Unix
+ * side cannot (JACK not realtime, RLIMIT_RTPRIO), fall back to the best
+ * Win32 priority so the thread at least beats normal host threads. */
+static void set_callback_priority(IWineASIO *This)
+{
+    struct asio_thread_priority_params params = { .handle = This->handle };
+    
+    UNIX_CALL(asio_set_thread_priority, &params);
+    
+    if (params.result == ASE_OK) {
+        if (params.priority)
+            TRACE("Callback thread realtime priority %d\n", params.priority);
+        return;
+    }
+    
+    WARN("No realtime scheduling for the callback thread, using THREAD_PRIORITY_TIME_CRITICAL\n");
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+}
+
+/* Pin the calling callback thread to "Callback CPU set", if configured */
+static void set_callback_affinity(IWineASIO *This)
+{
+    struct asio_thread_affinity_params params = { .handle = This->handle };
+    
+    UNIX_CALL(asio_set_thread_affinity, &params);
+    
+    if (params.result != ASE_OK)
+        WARN("Could not pin callback thread to CPUs '%s'\n", This->config.cpu_set);
+    else if (params.num_cpus)
+        TRACE("Callback thread pinned to %d CPUs (%s)\n", params.num_cpus, This->config.cpu_set);
+}
+
+/* Callback thread - blocks in the Unix side until a JACK thread queues
+ * an event, then calls into the host */
 static DWORD WINAPI callback_thread_proc(LPVOID arg)
 {
     IWineASIO *This = (IWineASIO *)arg;
     struct asio_get_callback_params params;
+    const struct asio_event *bswitch;
     
     TRACE("Callback thread started\n");
     
+    set_callback_priority(This);
+    set_callback_affinity(This);
+    set_denormal_mode(This);
+    
     while (!This->stop_callback_thread) {
         params.handle = This->handle;
+        params.timeout_ms = CALLBACK_WAIT_TIMEOUT;
         
-        UNIX_CALL(asio_get_callback, &params);
+        UNIX_CALL(asio_wait_callback, &params);
         
-        if (params.result == ASE_OK && params.buffer_switch_ready && This->callbacks) {
-            /* Handle sample rate change */
-            if (params.sample_rate_changed) {
-                TRACE("Sample rate changed to %f\n", params.new_sample_rate);
-                This->sample_rate = params.new_sample_rate;
-                This->callbacks->sampleRateDidChange(params.new_sample_rate);
-            }
-            
-            /* Handle reset request */
-            if (params.reset_request) {
-                TRACE("Reset requested\n");
-                This->callbacks->asioMessage(1 /* kAsioSelectorSupported */, 3 /* kAsioResetRequest */, NULL, NULL);
-                This->callbacks->asioMessage(3 /* kAsioResetRequest */, 0, NULL, NULL);
-            }
-            
-            /* Handle latency change */
-            if (params.latency_changed) {
-                TRACE("Latency changed\n");
-                This->callbacks->asioMessage(1, 6 /* kAsioLatenciesChanged */, NULL, NULL);
-                This->callbacks->asioMessage(6, 0, NULL, NULL);
-            }
-            
-            /* Buffer switch - no debug logging in hot path to avoid xruns */
-            if (This->time_info_mode) {
-                /* Use time info mode */
-                This->host_time.timeInfo.hi = (LONG)(params.time_info.sample_position >> 32);
-                This->host_time.timeInfo.lo = (LONG)(params.time_info.sample_position & 0xFFFFFFFF);
-                This->host_time.systemTime.hi = (LONG)(params.time_info.system_time >> 32);
-                This->host_time.systemTime.lo = (LONG)(params.time_info.system_time & 0xFFFFFFFF);
-                This->host_time.sampleRate = params.time_info.sample_rate;
-                This->host_time.flags = params.time_info.flags;
-                
-                This->callbacks->bufferSwitchTimeInfo(&This->host_time, params.buffer_index, params.direct_process);
-            } else {
-                /* Use simple buffer switch */
-                This->callbacks->bufferSwitch(params.buffer_index, params.direct_process);
+        if (This->stop_callback_thread)
+            break;
+        
+        if (params.result != ASE_OK || !params.num_events || !This->callbacks)
+            continue;
+        
+        bswitch = dispatch_callback(This, &params);
+        check_denormals(This);
+        
+        /* Report completion - sync mode releases the waiting JACK cycle,
+         * async mode uses it to detect host overruns */
+        if (bswitch) {
+            struct asio_callback_done_params done = {
+                .handle = This->handle,
+                .buffer_index = bswitch->buffer_index,
+                .sample_position = bswitch->sample_position,
+            };
+            UNIX_CALL(asio_callback_done, &done);
+        }
+    }
+    
+    TRACE("Callback thread stopped\n");
+    return 0;
+}
+
+/* Direct mode callback thread - takes over the JACK process cycle, so
+ * the host's bufferSwitch runs inside the cycle with no thread hop */
+static DWORD WINAPI direct_callback_thread_proc(LPVOID arg)
+{
+    IWineASIO *This = (IWineASIO *)arg;
+    struct asio_cycle_params cycle = { .handle = This->handle, .timeout_ms = 1000 };
+    struct asio_get_callback_params params;
+    BOOL reset_requested = FALSE;
+    
+    TRACE("Direct callback thread started\n");
+    
+    set_callback_priority(This);
+    set_callback_affinity(This);
+    set_denormal_mode(This);
+    
+    /* Without this thread attached nobody runs the host's buffer switches.
+     * Keep trying while JACK is stalled, and ask the host to reset once so
+     * the failure is not silent. */
+    for (;;) {
+        UNIX_CALL(asio_cycle_attach, &cycle);
+        if (cycle.result == ASE_OK)
+            break;
+        if (!reset_requested) {
+            ERR("Could not attach to the JACK process cycle: %d\n", cycle.result);
+            if (This->callbacks) {
+                This->callbacks->asioMessage(kAsioSelectorSupported, kAsioResetRequest, NULL, NULL);
+                This->callbacks->asioMessage(kAsioResetRequest, 0, NULL, NULL);
             }
+            reset_requested = TRUE;
         }
+        if (cycle.result != ASE_HWMalfunction || This->stop_callback_thread) {
+            TRACE("Direct callback thread stopped\n");
+            return 1;
+        }
+    }
+    
+    while (!This->stop_callback_thread) {
+        params.handle = This->handle;
         
-        /* Small sleep to avoid busy waiting - 1ms */
-        Sleep(1);
+        /* Finishes the previous cycle and waits for the next one */
+        UNIX_CALL(asio_process_cycle, &params);
+        
+        if (params.result != ASE_OK)
+            break;
+        
+        if (params.num_events && This->callbacks && !This->stop_callback_thread) {
+            dispatch_callback(This, &params);
+            check_denormals(This);
+        }
     }
     
-    TRACE("Callback thread stopped\n");
+    /* Hand the cycle back to JACK's own thread */
+    UNIX_CALL(asio_cycle_detach, &cycle);
+    
+    TRACE("Direct callback thread stopped\n");
     return 0;
 }
 
+/* Free the audio buffer arena. The Unix side must no longer use it. */
+static void free_buffer_arena(IWineASIO *This)
+{
+    if (!This->pe_audio_buffers)
+        return;
+    VirtualFree(This->pe_audio_buffers, 0, MEM_RELEASE);
+    This->pe_audio_buffers = NULL;
+    This->pe_arena_size = 0;
+}
+
 /* IUnknown methods */
 static HRESULT STDMETHODCALLTYPE QueryInterface(LPWINEASIO iface, REFIID riid, void **ppvObject)
 {
@@ -501,6 +910,11 @@ static ULONG STDMETHODCALLTYPE Release(LPWINEASIO iface)
             UNIX_CALL(asio_exit, &params);
         }
         
+        if (This->status)
+            VirtualFree(This->status, 0, MEM_RELEASE);
+        free_buffer_arena(This);
+        HeapFree(GetProcessHeap(), 0, This->channel_infos);
+        
         HeapFree(GetProcessHeap(), 0, This);
     }
     
@@ -518,9 +932,17 @@ LONG STDMETHODCALLTYPE Init(LPWINEASIO iface, void *sysRef)
     /* Read config from registry */
     read_config(This);
     
+    /* Status block shared with the Unix side. VirtualAlloc keeps it on its
+     * own page and, for 32-bit hosts, inside the 32-bit address space. */
+    if (!This->status)
+        This->status = VirtualAlloc(NULL, sizeof(*This->status), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!This->status)
+        WARN("Could not allocate status block, position queries will use unix calls\n");
+    
     /* Initialize Unix side */
     memset(&params, 0, sizeof(params));
     params.config = This->config;
+    params.status = (UINT64)(UINT_PTR)This->status;
     
     UNIX_CALL(asio_init, &params);
     
@@ -530,6 +952,11 @@ LONG STDMETHODCALLTYPE Init(LPWINEASIO iface, void *sysRef)
     }
     
     This->handle = params.handle;
+    HeapFree(GetProcessHeap(), 0, This->channel_infos);
+    This->channel_infos = NULL;
+    invalidate_description(This);
+    This->config.process_mode = params.process_mode;
+    This->config.sample_type = params.sample_type;
     This->num_inputs = params.input_channels;
     This->num_outputs = params.output_channels;
     This->sample_rate = params.sample_rate;
@@ -572,13 +999,20 @@ LONG STDMETHODCALLTYPE Start(LPWINEASIO iface)
         return params.result;
     }
     
-    /* Start callback polling thread */
+    /* No buffer switch delivered yet - OutputReady before the first one is ignored */
+    This->switch_index = 0;
+    This->switch_position = 0;
+    This->denormal_callbacks = 0;
+    
+    /* Start callback thread */
     This->stop_callback_thread = FALSE;
-    This->callback_thread = CreateThread(NULL, 0, callback_thread_proc, This, 0, NULL);
+    This->callback_thread = CreateThread(NULL, 0,
+        This->config.process_mode == WINEASIO_PROCESS_DIRECT ? direct_callback_thread_proc : callback_thread_proc,
+        This, 0, NULL);
     
-    /* Prime the first buffer */
-    /* Prime first buffer */
-    if (This->callbacks) {
+    /* Prime the first buffer - only in async mode, where the first JACK
+     * cycles send buffers the host has not been asked to fill yet */
+    if (This->callbacks && This->config.process_mode == WINEASIO_PROCESS_ASYNC) {
         if (This->time_info_mode) {
             memset(&This->host_time, 0, sizeof(This->host_time));
             This->host_time.sampleRate = This->sample_rate;
@@ -599,15 +1033,19 @@ LONG STDMETHODCALLTYPE Stop(LPWINEASIO iface)
     
     TRACE("iface=%p\n", iface);
     
-    /* Stop callback thread */
+    /* Stop the Unix side first - this also wakes the callback thread
+     * if it is blocked waiting for the next buffer switch */
+    This->stop_callback_thread = TRUE;
+    UNIX_CALL(asio_stop, &params);
+    
     if (This->callback_thread) {
-        This->stop_callback_thread = TRUE;
         WaitForSingleObject(This->callback_thread, 5000);
         CloseHandle(This->callback_thread);
         This->callback_thread = NULL;
     }
     
-    UNIX_CALL(asio_stop, &params);
+    if (This->denormal_callbacks)
+        TRACE("%u buffer switches hit denormals\n", (unsigned int)This->denormal_callbacks);
     
     return params.result;
 }
@@ -615,54 +1053,54 @@ LONG STDMETHODCALLTYPE Stop(LPWINEASIO iface)
 LONG STDMETHODCALLTYPE GetChannels(LPWINEASIO iface, LONG *numInputChannels, LONG *numOutputChannels)
 {
     IWineASIO *This = (IWineASIO *)iface;
-    struct asio_get_channels_params params = { .handle = This->handle };
     
     TRACE("iface=%p\n", iface);
     
     if (!numInputChannels || !numOutputChannels)
         return ASE_InvalidParameter;
     
-    UNIX_CALL(asio_get_channels, &params);
+    if (!describe_stream(This))
+        return This->desc.result;
     
-    *numInputChannels = params.num_inputs;
-    *numOutputChannels = params.num_outputs;
+    *numInputChannels = This->desc.num_inputs;
+    *numOutputChannels = This->desc.num_outputs;
     
-    return params.result;
+    return ASE_OK;
 }
 
 LONG STDMETHODCALLTYPE GetLatencies(LPWINEASIO iface, LONG *inputLatency, LONG *outputLatency)
 {
     IWineASIO *This = (IWineASIO *)iface;
-    struct asio_get_latencies_params params = { .handle = This->handle };
     
     TRACE("iface=%p\n", iface);
     
     if (!inputLatency || !outputLatency)
         return ASE_InvalidParameter;
     
-    UNIX_CALL(asio_get_latencies, &params);
+    if (!describe_stream(This))
+        return This->desc.result;
     
-    *inputLatency = params.input_latency;
-    *outputLatency = params.output_latency;
+    *inputLatency = This->desc.input_latency;
+    *outputLatency = This->desc.output_latency;
     
-    return params.result;
+    return ASE_OK;
 }
 
 LONG STDMETHODCALLTYPE GetBufferSize(LPWINEASIO iface, LONG *minSize, LONG *maxSize, LONG *preferredSize, LONG *granularity)
 {
     IWineASIO *This = (IWineASIO *)iface;
-    struct asio_get_buffer_size_params params = { .handle = This->handle };
     
     TRACE("iface=%p\n", iface);
     
-    UNIX_CALL(asio_get_buffer_size, &params);
+    if (!describe_stream(This))
+        return This->desc.result;
     
-    if (minSize) *minSize = params.min_size;
-    if (maxSize) *maxSize = params.max_size;
-    if (preferredSize) *preferredSize = params.preferred_size;
-    if (granularity) *granularity = params.granularity;
+    if (minSize) *minSize = This->desc.min_size;
+    if (maxSize) *maxSize = This->desc.max_size;
+    if (preferredSize) *preferredSize = This->desc.preferred_size;
+    if (granularity) *granularity = This->desc.granularity;
     
-    return params.result;
+    return ASE_OK;
 }
 
 LONG STDMETHODCALLTYPE CanSampleRate(LPWINEASIO iface, double sampleRate)
@@ -681,12 +1119,25 @@ LONG STDMETHODCALLTYPE GetSampleRate(LPWINEASIO iface, double *currentRate)
 {
     IWineASIO *This = (IWineASIO *)iface;
     struct asio_get_sample_rate_params params = { .handle = This->handle };
+    struct asio_status snap;
     
     TRACE("iface=%p\n", iface);
     
     if (!currentRate)
         return ASE_InvalidParameter;
     
+    if (read_status(This, &snap)) {
+        *currentRate = snap.sample_rate;
+        This->sample_rate = snap.sample_rate;
+        return ASE_OK;
+    }
+    
+    if (describe_stream(This)) {
+        *currentRate = This->desc.sample_rate;
+        This->sample_rate = This->desc.sample_rate;
+        return ASE_OK;
+    }
+    
     UNIX_CALL(asio_get_sample_rate, &params);
     
     *currentRate = params.sample_rate;
@@ -706,6 +1157,7 @@ LONG STDMETHODCALLTYPE SetSampleRate(LPWINEASIO iface, double sampleRate)
     
     if (params.result == ASE_OK)
         This->sample_rate = sampleRate;
+    invalidate_description(This);
     
     return params.result;
 }
@@ -733,12 +1185,22 @@ LONG STDMETHODCALLTYPE GetSamplePosition(LPWINEASIO iface, ASIOSamples *sPos, AS
 {
     IWineASIO *This = (IWineASIO *)iface;
     struct asio_get_sample_position_params params = { .handle = This->handle };
+    struct asio_status snap;
     
     /* Note: No TRACE here - called frequently during playback */
     
     if (!sPos || !tStamp)
         return ASE_InvalidParameter;
     
+    /* Fast path: a few loads from the status block instead of a unix call */
+    if (read_status(This, &snap)) {
+        sPos->hi = (LONG)(snap.sample_position >> 32);
+        sPos->lo = (LONG)(snap.sample_position & 0xFFFFFFFF);
+        tStamp->hi = (LONG)(snap.system_time >> 32);
+        tStamp->lo = (LONG)(snap.system_time & 0xFFFFFFFF);
+        return ASE_OK;
+    }
+    
     UNIX_CALL(asio_get_sample_position, &params);
     
     sPos->hi = (LONG)(params.sample_position >> 32);
@@ -752,27 +1214,29 @@ LONG STDMETHODCALLTYPE GetSamplePosition(LPWINEASIO iface, ASIOSamples *sPos, AS
 LONG STDMETHODCALLTYPE GetChannelInfo(LPWINEASIO iface, ASIOChannelInfo *info)
 {
     IWineASIO *This = (IWineASIO *)iface;
-    struct asio_get_channel_info_params params;
-    
-    TRACE("iface=%p channel=%d isInput=%d\n", iface, info->channel, info->isInput);
+    const struct asio_channel_info *cached;
     
     if (!info)
         return ASE_InvalidParameter;
     
-    memset(&params, 0, sizeof(params));
-    params.handle = This->handle;
-    params.info.channel = info->channel;
-    params.info.is_input = info->isInput;
+    TRACE("iface=%p channel=%d isInput=%d\n", iface, info->channel, info->isInput);
     
-    UNIX_CALL(asio_get_channel_info, &params);
+    if (!describe_stream(This))
+        return This->desc.result;
     
-    info->isActive = params.info.is_active;
-    info->channelGroup = params.info.channel_group;
-    info->type = params.info.sample_type;
-    strncpy(info->name, params.info.name, 31);
+    if (info->channel < 0 ||
+        info->channel >= (info->isInput ? This->desc.num_inputs : This->desc.num_outputs))
+        return ASE_InvalidParameter;
+    
+    /* Cached infos: inputs, then outputs */
+    cached = &This->channel_infos[info->isInput ? info->channel : This->desc.num_inputs + info->channel];
+    info->isActive = cached->is_active;
+    info->channelGroup = cached->channel_group;
+    info->type = cached->sample_type;
+    strncpy(info->name, cached->name, 31);
     info->name[31] = 0;
     
-    return params.result;
+    return ASE_OK;
 }
 
 LONG STDMETHODCALLTYPE CreateBuffers(LPWINEASIO iface, ASIOBufferInfo *bufferInfos, LONG numChannels, LONG bufferSize, ASIOCallbacks *callbacks)
@@ -781,7 +1245,7 @@ LONG STDMETHODCALLTYPE CreateBuffers(LPWINEASIO iface, ASIOBufferInfo *bufferInf
     struct asio_create_buffers_params params;
     struct asio_buffer_info *unix_infos;
     int i;
-    size_t buffer_bytes;
+    UINT64 stride;
     
     TRACE("iface=%p numChannels=%d bufferSize=%d\n", iface, numChannels, bufferSize);
     
@@ -795,88 +1259,101 @@ LONG STDMETHODCALLTYPE CreateBuffers(LPWINEASIO iface, ASIOBufferInfo *bufferInf
     /* Check for time info support */
     This->time_info_mode = FALSE;
     This->can_time_code = FALSE;
+    This->can_report_overload = FALSE;
     if (callbacks->asioMessage) {
-        if (callbacks->asioMessage(1 /* kAsioSelectorSupported */, 14 /* kAsioSupportsTimeInfo */, NULL, NULL) == 1)
+        if (callbacks->asioMessage(kAsioSelectorSupported, kAsioSupportsTimeInfo, NULL, NULL) == 1)
             This->time_info_mode = TRUE;
-        if (callbacks->asioMessage(1, 15 /* kAsioSupportsTimeCode */, NULL, NULL) == 1)
+        if (callbacks->asioMessage(kAsioSelectorSupported, kAsioSupportsTimeCode, NULL, NULL) == 1)
             This->can_time_code = TRUE;
+        if (callbacks->asioMessage(kAsioSelectorSupported, kAsioOverload, NULL, NULL) == 1)
+            This->can_report_overload = TRUE;
     }
     
-    TRACE("time_info_mode=%d can_time_code=%d\n", This->time_info_mode, This->can_time_code);
+    TRACE("time_info_mode=%d can_time_code=%d can_report_overload=%d\n",
+          This->time_info_mode, This->can_time_code, This->can_report_overload);
     
     /* Prepare Unix call */
     unix_infos = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, numChannels * sizeof(*unix_infos));
     if (!unix_infos)
         return ASE_NoMemory;
     
-    /* 
-     * WINE 11 WoW64 FIX: Allocate audio buffers on the PE (Windows) side!
+    for (i = 0; i < numChannels; i++) {
+        unix_infos[i].is_input = bufferInfos[i].isInput;
+        unix_infos[i].channel_num = bufferInfos[i].channelNum;
+    }
+    
+    /* Free old PE-side buffers if any */
+    free_buffer_arena(This);
+    This->pe_num_buffers = numChannels;
+    This->pe_buffer_size = asio_buffer_capacity(bufferSize, This->config.max_bufsize);
+    
+    memset(&params, 0, sizeof(params));
+    params.handle = This->handle;
+    params.num_channels = numChannels;
+    params.buffer_size = bufferSize;
+    params.buffer_infos = (UINT64)(UINT_PTR)unix_infos;
+    params.low_address = sizeof(void *) < sizeof(UINT64);
+    params.pe_state = (UINT64)(UINT_PTR)This;    /* host_time and the callback thread's state */
+    params.pe_state_size = sizeof(*This);
+    params.buffer_frames = asio_buffer_capacity(bufferSize, This->config.max_bufsize);
+    
+    /*
+     * WINE 11 WoW64 FIX: buffers must be addressable by the PE side.
      * 
      * In Wine 11 WoW64, the Unix side runs in 64-bit address space while
      * the 32-bit PE code runs in emulated 32-bit address space. Buffers
      * allocated with calloc() on Unix side have 64-bit addresses that
      * cannot be accessed by 32-bit Windows code.
      * 
-     * Solution: Allocate buffers here on PE side using HeapAlloc(), which
-     * guarantees 32-bit compatible addresses. Pass these pointers to Unix
-     * side for use in JACK callbacks.
+     * With "Unix buffers" the Unix side allocates the arena through ntdll
+     * in the 32-bit address space (huge pages optional) and fills in the
+     * buffer pointers. Otherwise, or if that fails, the arena is allocated
+     * here with VirtualAlloc(), which guarantees 32-bit compatible addresses.
+     * 
+     * Both use the layout of asio_buffer_layout(), grouped by buffer half,
+     * then direction, so each buffer switch touches one contiguous region
+     * and JACK-written inputs never share a cache line with host-written
+     * outputs.
      */
-    buffer_bytes = sizeof(float) * bufferSize;  /* JACK uses float samples */
-    
-    /* Free old PE-side buffers if any */
-    if (This->pe_audio_buffers) {
-        HeapFree(GetProcessHeap(), 0, This->pe_audio_buffers);
-        This->pe_audio_buffers = NULL;
+    if (This->config.unix_buffers) {
+        params.unix_alloc = TRUE;
+        UNIX_CALL(asio_create_buffers, &params);
+        if (!params.unix_alloc)
+            TRACE("Unix side could not allocate the buffers, using a PE-side arena\n");
     }
     
-    /* Allocate one big block for all buffers: numChannels * 2 (double-buffer) * buffer_bytes */
-    This->pe_audio_buffers = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, 
-                                        numChannels * 2 * buffer_bytes);
-    if (!This->pe_audio_buffers) {
-        HeapFree(GetProcessHeap(), 0, unix_infos);
-        return ASE_NoMemory;
-    }
-    This->pe_num_buffers = numChannels;
-    This->pe_buffer_size = bufferSize;
-    
-    for (i = 0; i < numChannels; i++) {
-        char *base = (char *)This->pe_audio_buffers;
-        size_t offset0 = (i * 2) * buffer_bytes;       /* First buffer for this channel */
-        size_t offset1 = (i * 2 + 1) * buffer_bytes;   /* Second buffer for this channel */
-        
-        unix_infos[i].is_input = bufferInfos[i].isInput;
-        unix_infos[i].channel_num = bufferInfos[i].channelNum;
+    if (!params.unix_alloc) {
+        stride = asio_buffer_stride(asio_sample_size(This->config.sample_type), params.buffer_frames,
+                                    This->config.page_align_buffers);
+        This->pe_arena_size = 2 * numChannels * stride;
+        This->pe_audio_buffers = VirtualAlloc(NULL, This->pe_arena_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!This->pe_audio_buffers) {
+            This->pe_arena_size = 0;
+            HeapFree(GetProcessHeap(), 0, unix_infos);
+            return ASE_NoMemory;
+        }
+        asio_buffer_layout(unix_infos, numChannels, (UINT64)(UINT_PTR)This->pe_audio_buffers, stride);
         
-        /* Set buffer pointers from PE-allocated memory */
-        unix_infos[i].buffer_ptr[0] = (UINT64)(UINT_PTR)(base + offset0);
-        unix_infos[i].buffer_ptr[1] = (UINT64)(UINT_PTR)(base + offset1);
+        TRACE("PE buffer arena: %lu byte stride, %lu bytes\n",
+              (unsigned long)stride, (unsigned long)This->pe_arena_size);
         
+        UNIX_CALL(asio_create_buffers, &params);
     }
     
-    memset(&params, 0, sizeof(params));
-    params.handle = This->handle;
-    params.num_channels = numChannels;
-    params.buffer_size = bufferSize;
-    params.buffer_infos = unix_infos;
-    
-    UNIX_CALL(asio_create_buffers, &params);
-    
     /* Copy buffer pointers back to ASIO bufferInfos structure */
     if (params.result == ASE_OK) {
         for (i = 0; i < numChannels; i++) {
-            /* Use the PE-side allocated pointers we set earlier */
+            /* Arena pointers set by asio_buffer_layout on either side */
             bufferInfos[i].buffers[0] = (void *)(UINT_PTR)unix_infos[i].buffer_ptr[0];
             bufferInfos[i].buffers[1] = (void *)(UINT_PTR)unix_infos[i].buffer_ptr[1];
         }
     } else {
         /* Failed - free PE buffers */
-        if (This->pe_audio_buffers) {
-            HeapFree(GetProcessHeap(), 0, This->pe_audio_buffers);
-            This->pe_audio_buffers = NULL;
-        }
+        free_buffer_arena(This);
     }
     
     HeapFree(GetProcessHeap(), 0, unix_infos);
+    invalidate_description(This);   /* Active channels and latencies changed */
     
     return params.result;
 }
@@ -891,6 +1368,9 @@ LONG STDMETHODCALLTYPE DisposeBuffers(LPWINEASIO iface)
     UNIX_CALL(asio_dispose_buffers, &params);
     
     This->callbacks = NULL;
+    if (params.result == ASE_OK)
+        free_buffer_arena(This);
+    invalidate_description(This);
     
     return params.result;
 }
@@ -927,7 +1407,13 @@ LONG STDMETHODCALLTYPE Future(LPWINEASIO iface, LONG selector, void *opt)
 LONG STDMETHODCALLTYPE OutputReady(LPWINEASIO iface)
 {
     IWineASIO *This = (IWineASIO *)iface;
-    struct asio_output_ready_params params = { .handle = This->handle };
+    struct asio_output_ready_params params = {
+        .handle = This->handle,
+        .buffer_index = This->switch_index,
+        .sample_position = This->switch_position,
+    };
+    
+    /* Note: No TRACE here - called once per buffer switch */
     
     UNIX_CALL(asio_output_ready, &params);
     
@@ -25,6 +25,10 @@
 
 /* config.h is not needed - we define what we need directly */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* cpu_set_t, pthread_setaffinity_np */
+#endif
+
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,8 +37,16 @@
 #include <limits.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sched.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <dlfcn.h>
+#include <fnmatch.h>
+#include <regex.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -57,6 +69,7 @@
 #include "wine/unixlib.h"
 
 #include "unixlib.h"
+#include "asio_convert.h"
 
 /* Define C_ASSERT if not available */
 #ifndef C_ASSERT
@@ -130,24 +143,93 @@ static int (*pjack_set_sample_rate_callback)(jack_client_t*, int (*)(jack_nframe
 static int (*pjack_set_latency_callback)(jack_client_t*, void (*)(jack_latency_callback_mode_t, void*), void*);
 static void (*pjack_port_get_latency_range)(jack_port_t*, jack_latency_callback_mode_t, jack_latency_range_t*);
 static jack_transport_state_t (*pjack_transport_query)(const jack_client_t*, jack_position_t*);
+static int (*pjack_set_process_thread)(jack_client_t*, void *(*)(void*), void*);
+static jack_nframes_t (*pjack_cycle_wait)(jack_client_t*);
+static void (*pjack_cycle_signal)(jack_client_t*, int);
+static float (*pjack_cpu_load)(jack_client_t*);
+static int (*pjack_set_xrun_callback)(jack_client_t*, int (*)(void*), void*);
+static float (*pjack_get_xrun_delayed_usecs)(jack_client_t*);
+static int (*pjack_client_real_time_priority)(jack_client_t*);
+static int (*pjack_set_thread_init_callback)(jack_client_t*, void (*)(void*), void*);
+static int (*pjack_set_port_registration_callback)(jack_client_t*, void (*)(jack_port_id_t, int, void*), void*);
+static jack_port_t* (*pjack_port_by_id)(jack_client_t*, jack_port_id_t);
+static int (*pjack_port_flags)(const jack_port_t*);
+static const char* (*pjack_port_type)(const jack_port_t*);
 
 #define JACK_DEFAULT_AUDIO_TYPE "32 bit float mono audio"
 #define JackPortIsInput  0x1
 #define JackPortIsOutput 0x2
 #define JackPortIsPhysical 0x4
 
-#define MAX_CHANNELS 128
 #define MAX_NAME_LENGTH 64
+#define JACK_PORT_NAME_SIZE 320     /* Client and port name with separator, as jack_port_name_size() */
+
+/* Stream, status block, channel tables, buffers, PE state and one safety
+ * ring per channel */
+#define LOCKED_REGIONS(stream) (5 + (stream)->num_inputs + (stream)->num_outputs)
 
-/* Channel state */
+/* Channel state - configuration, see ActiveChannel for the per-cycle copy */
 typedef struct {
     jack_port_t *port;
     char name[MAX_NAME_LENGTH];
     BOOL active;
     jack_default_audio_sample_t *audio_buffer;  /* Double buffer (legacy, Unix-allocated) */
-    jack_default_audio_sample_t *pe_buffer[2];  /* PE-side allocated buffers (Wine 11 WoW64 fix) */
+    void *pe_buffer[2];                         /* PE-side allocated buffers (Wine 11 WoW64 fix), in conv's type */
+    jack_default_audio_sample_t *ring;          /* Safety ring, ring_periods * buffer_size samples */
 } IOChannel;
 
+/* Audio ports of other clients that channels of one direction can connect
+ * to, in registration order. A port that goes away keeps its slot, so the
+ * channels paired with the following ports keep their peers and a
+ * replugged device reconnects to the same channels. */
+typedef struct {
+    char *name;
+    BOOL present;
+    BOOL physical;
+} PeerPort;
+
+typedef struct {
+    PeerPort *ports;
+    int count;
+    int capacity;
+} PortMap;
+
+/* Routing map rule, see parse_routes */
+typedef struct {
+    BOOL is_input;
+    int first;              /* Channel range, 0-based and inclusive */
+    int last;
+    BOOL regex;             /* Pattern is a POSIX extended regex, else a glob */
+    regex_t re;
+    char *pattern;
+} Route;
+
+/* A connection the connect worker made, by channel and peer slot */
+typedef struct {
+    BOOL is_input;
+    int channel;
+    int peer;
+} Connection;
+
+/* What the JACK cycle needs of an active channel, packed densely by
+ * build_active_channels so the cycle only walks channels the host uses */
+typedef struct {
+    jack_port_t *port;
+    void *pe_buffer[2];
+    jack_default_audio_sample_t *ring;
+    struct asio_dither dither;                  /* Capture dither state (inputs) */
+} ActiveChannel;
+
+/* Event queue size - must be a power of two */
+#define EVENT_RING_SIZE 64
+
+/* Event queue slot. sequence == position: free for the producer writing
+ * position; sequence == position + 1: holds the event for that position */
+typedef struct {
+    UINT32 sequence;
+    struct asio_event event;
+} EventSlot;
+
 /* Stream state - lives on Unix side */
 typedef struct {
     jack_client_t *client;
@@ -159,47 +241,160 @@ typedef struct {
     LONG input_latency;
     LONG output_latency;
     
-    /* Channels */
+    /* Channels, allocated for the configured counts by alloc_channels */
     int num_inputs;
     int num_outputs;
-    IOChannel inputs[MAX_CHANNELS];
-    IOChannel outputs[MAX_CHANNELS];
-    
-    /* Physical port counts */
-    int jack_num_input_ports;
-    int jack_num_output_ports;
-    const char **jack_input_ports;
-    const char **jack_output_ports;
+    IOChannel *inputs;
+    IOChannel *outputs;
+    
+    /* Autoconnect and routing map: peer port maps, enumerated once and
+     * then kept current by jack_port_registration_callback, and the
+     * worker that connects channels to them off the Init path */
+    PortMap peers_in;               /* Ports feeding audio, capture ports among them */
+    PortMap peers_out;              /* Ports taking audio, playback ports among them */
+    Route *routes;
+    int num_routes;
+    Connection *connections;        /* Dropped when either end goes away */
+    int num_connections;
+    int connections_capacity;
+    pthread_mutex_t connect_mutex;  /* Port maps, connections, plan generations */
+    pthread_cond_t connect_cond;    /* Plan changed or applied */
+    pthread_t connect_thread;
+    BOOL connect_thread_running;
+    BOOL connect_quit;
+    BOOL ports_enumerated;          /* Connect worker only */
+    UINT32 connect_requested;       /* Plan generation, bumped when ports come and go */
+    UINT32 connect_applied;         /* Generation the worker applied last */
     
     /* State */
     int state;  /* 0=Loaded, 1=Initialized, 2=Prepared, 3=Running */
     BOOL active_inputs;
     BOOL active_outputs;
     
+    /* Active channels in channel order, rebuilt by asio_create_buffers
+     * and asio_dispose_buffers while the stream is not running */
+    int num_active_in;
+    int num_active_out;
+    int num_idle_out;
+    ActiveChannel *active_in;       /* num_inputs entries, one block with active_out and idle_out */
+    ActiveChannel *active_out;
+    jack_port_t **idle_out;         /* Output ports the host left inactive, silenced */
+    SIZE_T tables_size;
+    
+    /* Lazy port unregistration, see quiesce_ports */
+    UINT32 port_seq;                /* Odd while the cycle uses port pointers */
+    jack_port_t **retired;          /* Cleared ports not yet unregistered */
+    int num_retired;
+    int retired_capacity;
+    
     /* Double buffering */
     LONG buffer_index;
+    LONG buffer_frames;         /* Samples each host buffer holds, at least buffer_size while Prepared */
+    struct asio_converter conv; /* Host sample type, fused into the buffer copies */
     jack_default_audio_sample_t *callback_audio_buffer;
     
-    /* Callback notification (polled by PE side) */
-    pthread_mutex_t callback_lock;
-    BOOL buffer_switch_pending;
-    LONG pending_buffer_index;
+    /* Callback notification (waited on by PE side) */
+    EventSlot events[EVENT_RING_SIZE];  /* Lock-free queue, see push_event */
+    UINT32 event_head;          /* Next slot to write (producers) */
+    UINT32 event_tail;          /* Next slot to read (PE callback thread only) */
+    UINT32 events_dropped;      /* Buffer switches lost because the queue was full */
+    UINT32 latched_events;      /* Other events the full queue could not take, bit per type */
+    double latched_values[ASIO_EVENT_BUFFER_SIZE + 1]; /* Newest value per latched type */
+    UINT32 describe_gen;        /* See bump_describe_gen */
+    sem_t callback_sem;         /* Posted per event, waited on in asio_wait_callback */
     INT64 sample_position;
     INT64 system_time;
-    BOOL sample_rate_changed;
-    double new_sample_rate;
-    BOOL reset_request;
-    BOOL latency_changed;
+    struct asio_status *status; /* Shared with the PE side, see publish_status */
+    UINT32 status_refs;         /* Threads using status, see get_status */
     
     /* Config */
+    struct asio_config config;  /* As passed to asio_init, to match a parked stream */
     BOOL autoconnect;
+    BOOL lazy_ports;            /* Register ports of activated channels only */
     BOOL fixed_bufsize;
     LONG preferred_bufsize;
+    LONG callback_spin;         /* Microseconds to spin before blocking */
+    LONG process_mode;          /* WINEASIO_PROCESS_* */
+    LONG sync_deadline;         /* Percent of the period to wait for the host */
+    LONG callback_policy;
+    LONG callback_priority;
+    cpu_set_t cpu_set;          /* Callback CPU set, valid if num_cpus > 0 */
+    int num_cpus;
+    char cpu_list[64];          /* Registry string, for messages */
+    BOOL pin_jack_thread;
+    BOOL denormal_protect;      /* FTZ/DAZ on the threads running the JACK cycle */
+    
+    /* Synchronous mode handshake (WINEASIO_PROCESS_SYNC) */
+    sem_t done_sem;             /* Posted by asio_callback_done */
+    INT64 release_position;     /* Position of the switch whose output the host released last */
+    INT64 done_position;        /* Position of the last buffer switch the host finished */
+    UINT32 host_overruns;       /* Buffer switches the host did not finish in time */
+    UINT32 jack_xruns;          /* Xruns reported by JACK */
+    
+    /* OutputReady: the host signals finished output buffers */
+    BOOL output_ready;          /* Host calls OutputReady after each switch */
+    LONG ready_index;           /* Buffer half of the last finished output */
+    INT64 ready_position;       /* Its sample position, published last */
+    
+    /* Direct mode (WINEASIO_PROCESS_DIRECT): the JACK process thread hands
+     * jack_cycle_wait/jack_cycle_signal to the PE callback thread */
+    LONG cycle_owner;               /* CYCLE_JACK, CYCLE_REQUESTED or CYCLE_PE */
+    sem_t attach_sem;               /* Posted by the JACK thread on handover */
+    sem_t handoff_sem;              /* Posted by the PE thread to hand back */
+    BOOL cycle_open;                /* Cycle waited for but not yet signalled */
+    LONG open_index;
+    jack_nframes_t open_nframes;
+    pthread_t cycle_thread;         /* PE thread that opened the cycle */
+    
+    /* Safety periods (async mode): rings of whole periods between the JACK
+     * cycle and the host's buffer switches absorb host jitter. Positions
+     * count periods and only ever increase. */
+    LONG safety_periods;
+    UINT32 ring_periods;            /* Ring capacity, 0 = rings disabled */
+    LONG ring_frames;               /* Period size the rings were sized for */
+    UINT32 in_write, in_read;       /* JACK thread writes, callback thread reads */
+    UINT32 out_write, out_read;     /* Callback thread writes, JACK thread reads */
+    
+    /* Buffer arena allocated here ("Unix buffers"), NULL if the PE side
+     * allocated the buffers */
+    void *arena_base;               /* NtAllocateVirtualMemory region */
+    char *arena;                    /* First buffer, huge page aligned if huge pages are used */
+    SIZE_T arena_size;
+    LONG huge_pages;                /* WINEASIO_HUGE_PAGES_* */
+    BOOL page_align_buffers;
+    
+    /* Memory the JACK cycle touches, mlock'ed while buffers exist */
+    BOOL lock_memory;
+    struct {
+        void *addr;
+        SIZE_T size;
+    } *locked;                      /* LOCKED_REGIONS entries */
+    int num_locked;
+    UINT32 lock_failures;           /* Regions mlock refused, see lock_region */
     
 } AsioStream;
 
 enum { Loaded = 0, Initialized, Prepared, Running };
 
+/* Direct mode cycle ownership. The PE thread moves JACK -> REQUESTED and,
+ * on timeout, back with a compare-and-swap; the JACK thread moves
+ * REQUESTED -> PE after jack_cycle_signal, so only one side wins a race. */
+enum { CYCLE_JACK = 0, CYCLE_REQUESTED, CYCLE_PE };
+
+/* Upper bound for the spin phase of asio_wait_callback, in microseconds */
+#define MAX_CALLBACK_SPIN 1000
+
+/* Default share of the period the RT thread waits for the host in sync mode */
+#define DEFAULT_SYNC_DEADLINE 90
+
+/* Upper bound for "Safety periods" */
+#define MAX_SAFETY_PERIODS 16
+
+/* x86_64 PMD huge page */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#define NtCurrentProcess() ((HANDLE)~(UINT_PTR)0)
+
 static BOOL jack_loaded = FALSE;
 
 /* Library constructor - called when .so is loaded */
@@ -249,6 +444,18 @@ static BOOL load_jack(void)
     LOAD_SYM(jack_set_latency_callback)
     LOAD_SYM(jack_port_get_latency_range)
     LOAD_SYM(jack_transport_query)
+    LOAD_SYM(jack_set_process_thread)
+    LOAD_SYM(jack_cycle_wait)
+    LOAD_SYM(jack_cycle_signal)
+    LOAD_SYM(jack_cpu_load)
+    LOAD_SYM(jack_set_xrun_callback)
+    LOAD_SYM(jack_get_xrun_delayed_usecs)
+    LOAD_SYM(jack_client_real_time_priority)
+    LOAD_SYM(jack_set_thread_init_callback)
+    LOAD_SYM(jack_set_port_registration_callback)
+    LOAD_SYM(jack_port_by_id)
+    LOAD_SYM(jack_port_flags)
+    LOAD_SYM(jack_port_type)
     
     #undef LOAD_SYM
     
@@ -264,6 +471,30 @@ static BOOL load_jack(void)
     return TRUE;
 }
 
+/* ntdll.so functions for the buffer arena. Resolved at runtime like JACK,
+ * as the library is not linked against ntdll.so. */
+static NTSTATUS (WINAPI *pNtAllocateVirtualMemory)(HANDLE, PVOID *, ULONG_PTR, SIZE_T *, ULONG, ULONG);
+static NTSTATUS (WINAPI *pNtFreeVirtualMemory)(HANDLE, PVOID *, SIZE_T *, ULONG);
+
+static BOOL load_ntdll(void)
+{
+    void *handle;
+    
+    if (pNtAllocateVirtualMemory && pNtFreeVirtualMemory)
+        return TRUE;
+    
+    handle = dlopen("ntdll.so", RTLD_NOW | RTLD_NOLOAD);
+    pNtAllocateVirtualMemory = dlsym(handle ? handle : RTLD_DEFAULT, "NtAllocateVirtualMemory");
+    pNtFreeVirtualMemory = dlsym(handle ? handle : RTLD_DEFAULT, "NtFreeVirtualMemory");
+    
+    if (!pNtAllocateVirtualMemory || !pNtFreeVirtualMemory) {
+        WARN("NtAllocateVirtualMemory not found in ntdll.so\n");
+        pNtAllocateVirtualMemory = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
 /* Get current time in nanoseconds */
 static INT64 get_system_time(void)
 {
@@ -272,267 +503,1609 @@ static INT64 get_system_time(void)
     return (INT64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-/* JACK process callback - runs in realtime thread */
-static int jack_process_callback(jack_nframes_t nframes, void *arg)
+static inline void cpu_relax(void)
 {
-    AsioStream *stream = (AsioStream *)arg;
-    int i;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* Wake the PE callback thread - sem_post is safe to call from the RT thread */
+static inline void signal_callback(AsioStream *stream)
+{
+    sem_post(&stream->callback_sem);
+}
+
+/* Take a reference to the PE-side status block, NULL once park_stream
+ * has taken it away. Every thread writing to the block holds one, so
+ * park_stream can wait until the block the PE side frees is unused. */
+static struct asio_status *get_status(AsioStream *stream)
+{
+    struct asio_status *status;
     
-    if (stream->state != Running) {
-        /* Output silence */
-        for (i = 0; i < stream->num_outputs; i++) {
-            if (stream->outputs[i].port) {
-                void *buf = pjack_port_get_buffer(stream->outputs[i].port, nframes);
-                if (buf) memset(buf, 0, sizeof(jack_default_audio_sample_t) * nframes);
-            }
-        }
-        return 0;
+    __atomic_add_fetch(&stream->status_refs, 1, __ATOMIC_SEQ_CST);
+    status = __atomic_load_n(&stream->status, __ATOMIC_SEQ_CST);
+    if (!status)
+        __atomic_sub_fetch(&stream->status_refs, 1, __ATOMIC_RELEASE);
+    return status;
+}
+
+static void put_status(AsioStream *stream)
+{
+    __atomic_sub_fetch(&stream->status_refs, 1, __ATOMIC_RELEASE);
+}
+
+/* Invalidate the PE side's cached stream description. Stored outside the
+ * seqlock, so it reaches the PE side before the next cycle's publish. */
+static void bump_describe_gen(AsioStream *stream)
+{
+    UINT32 gen = __atomic_add_fetch(&stream->describe_gen, 1, __ATOMIC_RELAXED);
+    struct asio_status *status = get_status(stream);
+    
+    if (status) {
+        __atomic_store_n(&status->describe_gen, gen, __ATOMIC_RELEASE);
+        put_status(stream);
     }
+}
+
+/* Keep a control event the full queue cannot take. Repeats of one type
+ * coalesce into a single event carrying the newest value, which is all the
+ * host needs; take_latched_events hands them out once the queue drains. */
+static void latch_event(AsioStream *stream, UINT32 type, double value)
+{
+    __atomic_store(&stream->latched_values[type], &value, __ATOMIC_RELAXED);
+    __atomic_or_fetch(&stream->latched_events, 1u << type, __ATOMIC_RELEASE);
+    signal_callback(stream);
+}
+
+/* Queue an event for the PE callback thread.
+ * Bounded multi-producer queue with per-slot sequence numbers: producers
+ * claim a position with a CAS on event_head, so the realtime thread never
+ * blocks on a lock; it can only retry when a notification thread (buffer
+ * size, sample rate, latency, xrun) claims the same position first.
+ * If the queue is full a buffer switch is counted as dropped and FALSE is
+ * returned; any other event is latched instead (see latch_event), so a
+ * notification is never lost. */
+static BOOL push_event(AsioStream *stream, UINT32 type, LONG buffer_index, double value)
+{
+    UINT32 pos = __atomic_load_n(&stream->event_head, __ATOMIC_RELAXED);
+    EventSlot *slot;
     
-    /* Copy JACK input buffers to PE-side buffer
-     * Wine 11 WoW64 fix: Use pe_buffer[] instead of audio_buffer
-     * pe_buffer[0] and pe_buffer[1] are pointers to PE-allocated memory */
-    for (i = 0; i < stream->num_inputs; i++) {
-        if (stream->inputs[i].active && stream->inputs[i].port) {
-            void *jack_buf = pjack_port_get_buffer(stream->inputs[i].port, nframes);
-            jack_default_audio_sample_t *pe_buf = stream->inputs[i].pe_buffer[stream->buffer_index];
-            if (jack_buf && pe_buf) {
-                memcpy(pe_buf, jack_buf, sizeof(jack_default_audio_sample_t) * nframes);
+    if (type == ASIO_EVENT_RESET || type == ASIO_EVENT_BUFFER_SIZE ||
+        type == ASIO_EVENT_SAMPLE_RATE || type == ASIO_EVENT_LATENCY)
+        bump_describe_gen(stream);
+    
+    for (;;) {
+        LONG diff;
+        
+        slot = &stream->events[pos & (EVENT_RING_SIZE - 1)];
+        diff = (LONG)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&stream->event_head, &pos, pos + 1, TRUE,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            if (type != ASIO_EVENT_BUFFER_SWITCH) {
+                latch_event(stream, type, value);
+                return TRUE;
             }
-            /* No logging in realtime callback - causes xruns */
+            __atomic_fetch_add(&stream->events_dropped, 1, __ATOMIC_RELAXED);
+            return FALSE;
+        } else {
+            pos = __atomic_load_n(&stream->event_head, __ATOMIC_RELAXED);
         }
     }
     
-    /* Copy PE-side output buffer to JACK
-     * Wine 11 WoW64 fix: Use pe_buffer[] instead of audio_buffer */
-    for (i = 0; i < stream->num_outputs; i++) {
-        if (stream->outputs[i].active && stream->outputs[i].port) {
-            void *jack_buf = pjack_port_get_buffer(stream->outputs[i].port, nframes);
-            jack_default_audio_sample_t *pe_buf = stream->outputs[i].pe_buffer[stream->buffer_index];
-            if (jack_buf && pe_buf) {
-                memcpy(jack_buf, pe_buf, sizeof(jack_default_audio_sample_t) * nframes);
-            }
-            /* No logging in realtime callback - causes xruns */
+    slot->event.type = type;
+    slot->event.seq = pos;
+    slot->event.buffer_index = buffer_index;
+    slot->event.sample_position = stream->sample_position;
+    slot->event.system_time = stream->system_time;
+    slot->event.value = value;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    
+    signal_callback(stream);
+    return TRUE;
+}
+
+/* The host did not finish a buffer switch in time - count it and let the
+ * PE side send kAsioOverload */
+static void note_host_overrun(AsioStream *stream)
+{
+    stream->host_overruns++;
+    push_event(stream, ASIO_EVENT_HOST_OVERRUN, -1, 0.0);
+}
+
+/* Publish position, time and rate to the PE-side status block.
+ * The JACK thread calls this every cycle with wait == FALSE and skips the
+ * update if a control call (wait == TRUE) holds the block - the next cycle
+ * publishes again - so the realtime thread never spins on another thread. */
+static void publish_status(AsioStream *stream, LONG buffer_index, BOOL wait)
+{
+    volatile struct asio_status *status = get_status(stream);
+    UINT32 seq;
+    
+    if (!status)
+        return;
+    
+    for (;;) {
+        seq = __atomic_load_n(&status->seq, __ATOMIC_RELAXED);
+        if (!(seq & 1) && __atomic_compare_exchange_n(&status->seq, &seq, seq + 1, FALSE,
+                                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        if (!wait) {
+            put_status(stream);
+            return;
         }
+        cpu_relax();
     }
     
-    /* Update sample position */
-    stream->sample_position += nframes;
-    stream->system_time = get_system_time();
-    
-    /* Signal buffer switch to PE side */
-    pthread_mutex_lock(&stream->callback_lock);
-    stream->pending_buffer_index = stream->buffer_index;
-    stream->buffer_switch_pending = TRUE;
-    pthread_mutex_unlock(&stream->callback_lock);
+    status->buffer_index = buffer_index;
+    status->sample_position = stream->sample_position;
+    status->system_time = stream->system_time;
+    status->sample_rate = stream->sample_rate;
+    status->host_overruns = stream->host_overruns;
+    status->jack_xruns = stream->jack_xruns;
+    status->lock_failures = stream->lock_failures;
+    status->describe_gen = __atomic_load_n(&stream->describe_gen, __ATOMIC_RELAXED);
+    if (pjack_cpu_load && stream->client)
+        status->load = pjack_cpu_load(stream->client);
+    
+    __atomic_store_n(&status->seq, seq + 2, __ATOMIC_RELEASE);
+    put_status(stream);
+}
+
+/* Take the oldest event from the queue - PE callback thread only */
+static BOOL pop_event(AsioStream *stream, struct asio_event *event)
+{
+    UINT32 pos = stream->event_tail;
+    EventSlot *slot = &stream->events[pos & (EVENT_RING_SIZE - 1)];
     
-    /* Switch buffers */
-    stream->buffer_index = stream->buffer_index ? 0 : 1;
+    if ((LONG)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (pos + 1)) < 0)
+        return FALSE;
     
-    return 0;
+    *event = slot->event;
+    __atomic_store_n(&slot->sequence, pos + EVENT_RING_SIZE, __ATOMIC_RELEASE);
+    stream->event_tail = pos + 1;
+    return TRUE;
 }
 
-/* JACK buffer size callback */
-static int jack_buffer_size_callback(jack_nframes_t nframes, void *arg)
+/* Whether pop_event would succeed - PE callback thread only */
+static BOOL event_pending(AsioStream *stream)
 {
-    AsioStream *stream = (AsioStream *)arg;
+    UINT32 pos = stream->event_tail;
+    EventSlot *slot = &stream->events[pos & (EVENT_RING_SIZE - 1)];
     
-    TRACE("Buffer size changed to %u\n", nframes);
-    stream->buffer_size = nframes;
-    
-    pthread_mutex_lock(&stream->callback_lock);
-    stream->reset_request = TRUE;
-    pthread_mutex_unlock(&stream->callback_lock);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == pos + 1 ||
+           __atomic_load_n(&stream->latched_events, __ATOMIC_RELAXED);
+}
+
+static void init_events(AsioStream *stream)
+{
+    UINT32 i;
     
-    return 0;
+    for (i = 0; i < EVENT_RING_SIZE; i++)
+        stream->events[i].sequence = i;
+    stream->event_head = 0;
+    stream->event_tail = 0;
+    stream->latched_events = 0;
 }
 
-/* JACK sample rate callback */
-static int jack_sample_rate_callback(jack_nframes_t nframes, void *arg)
+/* Wait until a JACK thread signals an event or the timeout expires.
+ * Optionally spins for stream->callback_spin microseconds first, which
+ * avoids the scheduler wakeup latency on very small buffer sizes. */
+static BOOL wait_for_callback(AsioStream *stream, LONG timeout_ms)
 {
-    AsioStream *stream = (AsioStream *)arg;
+    struct timespec ts;
+    int ret;
     
-    TRACE("Sample rate changed to %u\n", nframes);
+    if (stream->callback_spin > 0) {
+        INT64 deadline = get_system_time() + (INT64)stream->callback_spin * 1000;
+        
+        do {
+            if (sem_trywait(&stream->callback_sem) == 0)
+                goto signaled;
+            cpu_relax();
+        } while (get_system_time() < deadline);
+    }
     
-    pthread_mutex_lock(&stream->callback_lock);
-    stream->sample_rate_changed = TRUE;
-    stream->new_sample_rate = (double)nframes;
-    pthread_mutex_unlock(&stream->callback_lock);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
     
-    stream->sample_rate = (double)nframes;
+    while ((ret = sem_timedwait(&stream->callback_sem, &ts)) != 0 && errno == EINTR);
+    if (ret != 0)
+        return FALSE;
     
-    return 0;
+signaled:
+    /* The caller drains the whole event queue, so the posts for the other
+     * queued events carry no information - drop them to avoid spurious wakeups */
+    while (sem_trywait(&stream->callback_sem) == 0);
+    return TRUE;
 }
 
-/* JACK latency callback */
-static void jack_latency_callback(jack_latency_callback_mode_t mode, void *arg)
+/* Wait in the RT thread until the host releases the buffer switch just
+ * pushed, or until sync_deadline percent of the period has passed */
+static BOOL wait_for_host(AsioStream *stream, jack_nframes_t nframes)
 {
-    AsioStream *stream = (AsioStream *)arg;
+    struct timespec ts;
+    INT64 timeout;
+    int ret;
+    
+    timeout = (INT64)nframes * 1000000000LL / (INT64)stream->sample_rate;
+    timeout = timeout * stream->sync_deadline / 100;
+    
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000000000LL;
+    ts.tv_nsec += timeout % 1000000000LL;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
     
-    pthread_mutex_lock(&stream->callback_lock);
-    stream->latency_changed = TRUE;
-    pthread_mutex_unlock(&stream->callback_lock);
+    for (;;) {
+        ret = sem_timedwait(&stream->done_sem, &ts);
+        if (ret != 0 && errno == EINTR)
+            continue;
+        if (ret != 0)
+            return FALSE;
+        /* Ignore a late acknowledgement for a cycle that already timed
+         * out - the buffer index repeats every other cycle, the position
+         * of the switch does not */
+        if (__atomic_load_n(&stream->release_position, __ATOMIC_ACQUIRE) == stream->sample_position)
+            return TRUE;
+    }
 }
 
-static AsioStream *handle_to_stream(asio_handle h)
+/* The JACK cycle brackets the code that uses port pointers, so
+ * quiesce_ports can tell when a cleared pointer is no longer held.
+ * port_seq is odd inside; only one thread runs the cycle at a time. */
+static inline void enter_port_section(AsioStream *stream)
 {
-    return (AsioStream *)(UINT_PTR)h;
+    __atomic_add_fetch(&stream->port_seq, 1, __ATOMIC_SEQ_CST);
 }
 
-/*
- * Unix function implementations
- */
+static inline void leave_port_section(AsioStream *stream)
+{
+    __atomic_add_fetch(&stream->port_seq, 1, __ATOMIC_RELEASE);
+}
 
-static NTSTATUS asio_init(void *args)
+/* Copy JACK input buffers to the PE-side buffer for buffer_index
+ * Wine 11 WoW64 fix: Use pe_buffer[] instead of audio_buffer
+ * pe_buffer[0] and pe_buffer[1] are pointers to PE-allocated memory */
+static void copy_inputs(AsioStream *stream, LONG buffer_index, jack_nframes_t nframes)
 {
-    struct asio_init_params *params = args;
-    AsioStream *stream;
-    jack_status_t status;
-    jack_options_t options;
     int i;
     
-    TRACE("asio_init called\n");
-    
-    if (!load_jack()) {
-        ERR("Could not load JACK library\n");
-        params->result = ASE_NotPresent;
-        return STATUS_SUCCESS;
-    }
+    /* Period larger than the buffers - the host is being reset */
+    if ((LONG)nframes > stream->buffer_frames)
+        return;
     
-    stream = calloc(1, sizeof(*stream));
-    if (!stream) {
-        params->result = ASE_NoMemory;
-        return STATUS_SUCCESS;
+    for (i = 0; i < stream->num_active_in; i++) {
+        ActiveChannel *ch = &stream->active_in[i];
+        void *jack_buf = pjack_port_get_buffer(ch->port, nframes);
+        if (jack_buf)
+            asio_to_host_dithered(&stream->conv, &ch->dither, ch->pe_buffer[buffer_index], jack_buf, nframes);
+        /* No logging in realtime callback - causes xruns */
     }
+}
+
+static void silence_port(jack_port_t *port, jack_nframes_t nframes)
+{
+    void *jack_buf = pjack_port_get_buffer(port, nframes);
     
-    /* Copy config */
-    stream->num_inputs = params->config.num_inputs > 0 ? params->config.num_inputs : 2;
-    stream->num_outputs = params->config.num_outputs > 0 ? params->config.num_outputs : 2;
-    stream->preferred_bufsize = params->config.preferred_bufsize > 0 ? params->config.preferred_bufsize : 1024;
-    stream->fixed_bufsize = params->config.fixed_bufsize;
-    stream->autoconnect = params->config.autoconnect;
+    if (jack_buf)
+        memset(jack_buf, 0, sizeof(jack_default_audio_sample_t) * nframes);
+}
+
+/* Silence the output ports the host did not activate */
+static void silence_idle_outputs(AsioStream *stream, jack_nframes_t nframes)
+{
+    int i;
     
-    if (stream->num_inputs > MAX_CHANNELS) stream->num_inputs = MAX_CHANNELS;
-    if (stream->num_outputs > MAX_CHANNELS) stream->num_outputs = MAX_CHANNELS;
+    for (i = 0; i < stream->num_idle_out; i++)
+        silence_port(stream->idle_out[i], nframes);
+}
+
+/* Copy the PE-side output buffer for buffer_index to JACK, or silence
+ * every output if buffer_index is negative */
+static void copy_outputs(AsioStream *stream, LONG buffer_index, jack_nframes_t nframes)
+{
+    int i;
     
-    /* Set client name */
-    if (params->config.client_name[0]) {
-        memcpy(stream->client_name, params->config.client_name, MAX_NAME_LENGTH - 1);
-        stream->client_name[MAX_NAME_LENGTH - 1] = '\0';
-    } else {
-        memcpy(stream->client_name, "WineASIO", 9);
+    if (buffer_index < 0 || (LONG)nframes > stream->buffer_frames) {
+        /* Not running - the channel tables may be rebuilt at any time - or
+         * a period larger than the buffers until the host is reset */
+        for (i = 0; i < stream->num_outputs; i++) {
+            jack_port_t *port = __atomic_load_n(&stream->outputs[i].port, __ATOMIC_SEQ_CST);
+            if (port)
+                silence_port(port, nframes);
+        }
+        return;
     }
     
-    /* Open JACK client */
-    options = JackNoStartServer;  /* Don't start JACK if not running */
-    stream->client = pjack_client_open(stream->client_name, options, &status);
-    if (!stream->client) {
-        ERR("Could not open JACK client '%s' (status=0x%x)\n", stream->client_name, status);
-        free(stream);
-        params->result = ASE_NotPresent;
-        return STATUS_SUCCESS;
+    for (i = 0; i < stream->num_active_out; i++) {
+        ActiveChannel *ch = &stream->active_out[i];
+        void *jack_buf = pjack_port_get_buffer(ch->port, nframes);
+        if (jack_buf)
+            stream->conv.from_host(jack_buf, ch->pe_buffer[buffer_index], nframes, stream->conv.scale);
+        /* No logging in realtime callback - causes xruns */
     }
+    silence_idle_outputs(stream, nframes);
+}
+
+static inline jack_default_audio_sample_t *ring_period(const AsioStream *stream, const ActiveChannel *ch, UINT32 pos)
+{
+    return ch->ring + (size_t)(pos % stream->ring_periods) * stream->ring_frames;
+}
+
+/* Safety ring cycle: JACK's input goes into the input ring and the output
+ * is taken from the output ring. The host's buffer halves are only touched
+ * by the callback thread (ring_take_input / ring_put_output). */
+static void ring_process(AsioStream *stream, jack_nframes_t nframes)
+{
+    UINT32 in_read = __atomic_load_n(&stream->in_read, __ATOMIC_ACQUIRE);
+    UINT32 out_write = __atomic_load_n(&stream->out_write, __ATOMIC_ACQUIRE);
+    BOOL have_output = out_write != stream->out_read && (LONG)nframes == stream->ring_frames;
+    int i;
     
-    /* Get JACK info */
-    stream->sample_rate = pjack_get_sample_rate(stream->client);
-    stream->buffer_size = pjack_get_buffer_size(stream->client);
-    
-    /* Initialize mutex */
-    pthread_mutex_init(&stream->callback_lock, NULL);
-    
-    /* Register ports */
-    for (i = 0; i < stream->num_inputs; i++) {
-        snprintf(stream->inputs[i].name, MAX_NAME_LENGTH, "in_%d", i + 1);
-        stream->inputs[i].port = pjack_port_register(stream->client,
-            stream->inputs[i].name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-        stream->inputs[i].active = FALSE;
+    /* Queue this input period while the ring has room. If the host is a
+     * whole ring behind, or the period size no longer matches, it is dropped. */
+    if (stream->in_write - in_read < stream->ring_periods && (LONG)nframes == stream->ring_frames) {
+        for (i = 0; i < stream->num_active_in; i++) {
+            ActiveChannel *ch = &stream->active_in[i];
+            void *jack_buf = pjack_port_get_buffer(ch->port, nframes);
+            if (jack_buf)
+                memcpy(ring_period(stream, ch, stream->in_write), jack_buf,
+                       sizeof(jack_default_audio_sample_t) * nframes);
+        }
+        __atomic_store_n(&stream->in_write, stream->in_write + 1, __ATOMIC_RELEASE);
     }
     
-    for (i = 0; i < stream->num_outputs; i++) {
-        snprintf(stream->outputs[i].name, MAX_NAME_LENGTH, "out_%d", i + 1);
-        stream->outputs[i].port = pjack_port_register(stream->client,
-            stream->outputs[i].name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-        stream->outputs[i].active = FALSE;
+    for (i = 0; i < stream->num_active_out; i++) {
+        ActiveChannel *ch = &stream->active_out[i];
+        void *jack_buf = pjack_port_get_buffer(ch->port, nframes);
+        if (!jack_buf)
+            continue;
+        if (have_output)
+            memcpy(jack_buf, ring_period(stream, ch, stream->out_read),
+                   sizeof(jack_default_audio_sample_t) * nframes);
+        else
+            memset(jack_buf, 0, sizeof(jack_default_audio_sample_t) * nframes);
     }
+    silence_idle_outputs(stream, nframes);
+    
+    /* A period of another size is not the host's fault - it plays silence
+     * until the host has reset for the new size */
+    if (have_output)
+        __atomic_store_n(&stream->out_read, stream->out_read + 1, __ATOMIC_RELEASE);
+    else if ((LONG)nframes == stream->ring_frames)
+        note_host_overrun(stream);
+}
+
+/* Callback thread: fill the host's input buffers for a buffer switch */
+static void ring_take_input(AsioStream *stream, LONG buffer_index)
+{
+    UINT32 in_write = __atomic_load_n(&stream->in_write, __ATOMIC_ACQUIRE);
+    BOOL have_input = in_write != stream->in_read;
+    int i;
     
-    /* Get physical ports */
-    stream->jack_input_ports = pjack_get_ports(stream->client, NULL, NULL,
-        JackPortIsPhysical | JackPortIsOutput);
-    for (stream->jack_num_input_ports = 0;
-         stream->jack_input_ports && stream->jack_input_ports[stream->jack_num_input_ports];
-         stream->jack_num_input_ports++);
-    
-    stream->jack_output_ports = pjack_get_ports(stream->client, NULL, NULL,
-        JackPortIsPhysical | JackPortIsInput);
-    for (stream->jack_num_output_ports = 0;
-         stream->jack_output_ports && stream->jack_output_ports[stream->jack_num_output_ports];
-         stream->jack_num_output_ports++);
+    for (i = 0; i < stream->num_active_in; i++) {
+        ActiveChannel *ch = &stream->active_in[i];
+        void *pe_buf = ch->pe_buffer[buffer_index];
+        
+        if (have_input)
+            asio_to_host_dithered(&stream->conv, &ch->dither, pe_buf,
+                                  ring_period(stream, ch, stream->in_read), stream->ring_frames);
+        else
+            memset(pe_buf, 0, (size_t)stream->conv.sample_size * stream->ring_frames);
+    }
     
-    /* Set callbacks */
-    pjack_set_process_callback(stream->client, jack_process_callback, stream);
-    pjack_set_buffer_size_callback(stream->client, jack_buffer_size_callback, stream);
-    pjack_set_sample_rate_callback(stream->client, jack_sample_rate_callback, stream);
-    if (pjack_set_latency_callback)
-        pjack_set_latency_callback(stream->client, jack_latency_callback, stream);
+    if (have_input)
+        __atomic_store_n(&stream->in_read, stream->in_read + 1, __ATOMIC_RELEASE);
+}
+
+/* Callback thread: queue the host's finished output buffers */
+static void ring_put_output(AsioStream *stream, LONG buffer_index)
+{
+    UINT32 out_read = __atomic_load_n(&stream->out_read, __ATOMIC_ACQUIRE);
+    int i;
     
-    /* Activate JACK client */
-    if (pjack_activate(stream->client)) {
-        ERR("Could not activate JACK client\n");
-        pjack_client_close(stream->client);
-        free(stream);
-        params->result = ASE_HWMalfunction;
-        return STATUS_SUCCESS;
-    }
+    if (stream->out_write - out_read >= stream->ring_periods)
+        return;
     
-    /* Auto-connect if requested */
-    if (stream->autoconnect) {
-        for (i = 0; i < stream->num_inputs && i < stream->jack_num_input_ports; i++) {
-            if (stream->inputs[i].port && stream->jack_input_ports[i]) {
-                pjack_connect(stream->client, stream->jack_input_ports[i],
-                    pjack_port_name(stream->inputs[i].port));
-            }
-        }
-        for (i = 0; i < stream->num_outputs && i < stream->jack_num_output_ports; i++) {
-            if (stream->outputs[i].port && stream->jack_output_ports[i]) {
-                pjack_connect(stream->client, pjack_port_name(stream->outputs[i].port),
-                    stream->jack_output_ports[i]);
-            }
-        }
+    for (i = 0; i < stream->num_active_out; i++) {
+        ActiveChannel *ch = &stream->active_out[i];
+        stream->conv.from_host(ring_period(stream, ch, stream->out_write), ch->pe_buffer[buffer_index],
+                               stream->ring_frames, stream->conv.scale);
     }
     
-    stream->state = Initialized;
+    __atomic_store_n(&stream->out_write, stream->out_write + 1, __ATOMIC_RELEASE);
+}
+
+/* Reset the rings, with the output ring holding safety_periods of silence */
+static void ring_reset(AsioStream *stream)
+{
+    int i;
     
-    /* Return info */
-    params->handle = (asio_handle)(UINT_PTR)stream;
-    params->input_channels = stream->num_inputs;
-    params->output_channels = stream->num_outputs;
-    params->sample_rate = stream->sample_rate;
-    params->result = ASE_OK;
+    if (!stream->ring_periods)
+        return;
     
-    /* Single success message - useful to see WineASIO loaded */
-    fprintf(stderr, "[WineASIO] Initialized: %d in, %d out, %.0f Hz, %d samples\n",
-          stream->num_inputs, stream->num_outputs, stream->sample_rate, stream->buffer_size);
+    for (i = 0; i < stream->num_outputs; i++) {
+        if (stream->outputs[i].ring)
+            memset(stream->outputs[i].ring, 0,
+                   sizeof(jack_default_audio_sample_t) * stream->ring_periods * stream->ring_frames);
+    }
     
-    return STATUS_SUCCESS;
+    stream->in_write = stream->in_read = 0;
+    stream->out_read = 0;
+    stream->out_write = stream->safety_periods;
 }
 
-static NTSTATUS asio_exit(void *args)
+/* Peer port map entry for name, or -1 */
+static int port_map_find(const PortMap *map, const char *name)
 {
-    TRACE("%s called\n", __func__);
-    struct asio_exit_params *params = args;
-    AsioStream *stream = handle_to_stream(params->handle);
     int i;
     
-    if (!stream) {
-        params->result = ASE_InvalidParameter;
-        return STATUS_SUCCESS;
-    }
-    
-    TRACE("Shutting down WineASIO\n");
+    for (i = 0; i < map->count; i++)
+        if (!strcmp(map->ports[i].name, name))
+            return i;
+    return -1;
+}
+
+/* Add a peer port, reusing its slot if it was there before. Returns its
+ * index, or -1 if out of memory. */
+static int port_map_add(PortMap *map, const char *name, BOOL physical)
+{
+    int index = port_map_find(map, name);
     
-    /* Deactivate and close */
-    if (stream->client) {
-        pjack_deactivate(stream->client);
+    if (index >= 0) {
+        map->ports[index].present = TRUE;
+        return index;
+    }
+    if (map->count == map->capacity) {
+        int capacity = map->capacity ? 2 * map->capacity : 16;
+        PeerPort *ports = realloc(map->ports, capacity * sizeof(*ports));
+        
+        if (!ports)
+            return -1;
+        map->ports = ports;
+        map->capacity = capacity;
+    }
+    if (!(map->ports[map->count].name = strdup(name)))
+        return -1;
+    map->ports[map->count].present = TRUE;
+    map->ports[map->count].physical = physical;
+    return map->count++;
+}
+
+static void port_map_free(PortMap *map)
+{
+    int i;
+    
+    for (i = 0; i < map->count; i++)
+        free(map->ports[i].name);
+    free(map->ports);
+    memset(map, 0, sizeof(*map));
+}
+
+/* Routing map, the "Routing map" registry string: rules separated by ';',
+ * each "<channels>=<pattern>". Channels are in_N, in_N-M or in_* (out_
+ * likewise), numbered from 1 like the port names. The pattern is a glob
+ * matched against full JACK port names, or a POSIX extended regex after a
+ * '~'. A range pairs its channels with the matching ports in order; a
+ * single channel connects to every match. */
+static void parse_routes(AsioStream *stream, const char *spec)
+{
+    char *copy = strdup(spec), *rule, *next, *pattern, *end;
+    Route *route;
+    int count;
+    
+    if (!copy)
+        return;
+    for (rule = strtok_r(copy, ";\n", &next); rule; rule = strtok_r(NULL, ";\n", &next)) {
+        while (*rule == ' ' || *rule == '\t') rule++;
+        if (!*rule)
+            continue;
+        if (!(pattern = strchr(rule, '='))) {
+            WARN("Routing map: no '=' in '%s'\n", rule);
+            continue;
+        }
+        *pattern++ = '\0';
+        while (*pattern == ' ' || *pattern == '\t') pattern++;
+        for (end = pattern + strlen(pattern); end > pattern && (end[-1] == ' ' || end[-1] == '\t'); end--);
+        *end = '\0';
+        
+        route = realloc(stream->routes, (stream->num_routes + 1) * sizeof(*route));
+        if (!route)
+            break;
+        stream->routes = route;
+        route += stream->num_routes;
+        memset(route, 0, sizeof(*route));
+        
+        if (!strncmp(rule, "in_", 3)) {
+            route->is_input = TRUE;
+            rule += 3;
+        } else if (!strncmp(rule, "out_", 4)) {
+            rule += 4;
+        } else {
+            WARN("Routing map: channels must start with in_ or out_: '%s'\n", rule);
+            continue;
+        }
+        count = route->is_input ? stream->num_inputs : stream->num_outputs;
+        if (*rule == '*') {
+            route->first = 0;
+            route->last = count - 1;
+        } else {
+            route->first = route->last = strtol(rule, &end, 10) - 1;
+            if (*end == '-')
+                route->last = strtol(end + 1, &end, 10) - 1;
+            while (*end == ' ' || *end == '\t') end++;
+            if (*end || route->first < 0 || route->last < route->first) {
+                WARN("Routing map: bad channel range for '%s'\n", pattern);
+                continue;
+            }
+            if (route->last >= count)
+                route->last = count - 1;
+        }
+        if (route->first >= count || !*pattern)
+            continue;
+        
+        if (*pattern == '~') {
+            route->regex = TRUE;
+            if (regcomp(&route->re, pattern + 1, REG_EXTENDED | REG_NOSUB)) {
+                WARN("Routing map: bad regex '%s'\n", pattern + 1);
+                continue;
+            }
+        } else if (!(route->pattern = strdup(pattern))) {
+            continue;
+        }
+        stream->num_routes++;
+    }
+    free(copy);
+}
+
+static void free_routes(AsioStream *stream)
+{
+    int i;
+    
+    for (i = 0; i < stream->num_routes; i++) {
+        if (stream->routes[i].regex)
+            regfree(&stream->routes[i].re);
+        free(stream->routes[i].pattern);
+    }
+    free(stream->routes);
+    stream->routes = NULL;
+    stream->num_routes = 0;
+}
+
+static BOOL route_matches(const Route *route, const char *name)
+{
+    return route->regex ? !regexec(&route->re, name, 0, NULL, 0) : !fnmatch(route->pattern, name, 0);
+}
+
+/* Channel covered by a routing rule: autoconnect leaves it alone */
+static BOOL channel_routed(const AsioStream *stream, BOOL is_input, int channel)
+{
+    int i;
+    
+    for (i = 0; i < stream->num_routes; i++)
+        if (stream->routes[i].is_input == is_input &&
+            channel >= stream->routes[i].first && channel <= stream->routes[i].last)
+            return TRUE;
+    return FALSE;
+}
+
+static BOOL wants_connections(const AsioStream *stream)
+{
+    return stream->autoconnect || stream->num_routes;
+}
+
+/* Connections, under connect_mutex. -1 matches any channel or peer. */
+static int find_connection(const AsioStream *stream, BOOL is_input, int channel, int peer)
+{
+    int i;
+    
+    for (i = 0; i < stream->num_connections; i++) {
+        const Connection *c = &stream->connections[i];
+        
+        if (c->is_input == is_input && (channel < 0 || c->channel == channel) &&
+            (peer < 0 || c->peer == peer))
+            return i;
+    }
+    return -1;
+}
+
+static void add_connection(Connection **list, int *count, int *capacity, BOOL is_input, int channel, int peer)
+{
+    if (*count == *capacity) {
+        int size = *capacity ? 2 * *capacity : 64;
+        Connection *grown = realloc(*list, size * sizeof(*grown));
+        
+        if (!grown)
+            return;
+        *list = grown;
+        *capacity = size;
+    }
+    (*list)[*count].is_input = is_input;
+    (*list)[*count].channel = channel;
+    (*list)[(*count)++].peer = peer;
+}
+
+static void drop_connections(AsioStream *stream, BOOL is_input, int channel, int peer)
+{
+    int i;
+    
+    while ((i = find_connection(stream, is_input, channel, peer)) >= 0)
+        stream->connections[i] = stream->connections[--stream->num_connections];
+}
+
+/* Under connect_mutex. The flag is read with atomics, outside the status
+ * seqlock, like describe_gen. */
+static void publish_connections(AsioStream *stream)
+{
+    struct asio_status *status = get_status(stream);
+    
+    if (status) {
+        __atomic_store_n(&status->connections_ready,
+                         stream->connect_applied == stream->connect_requested, __ATOMIC_RELEASE);
+        put_status(stream);
+    }
+}
+
+/* Our own ports are not peers */
+static BOOL own_port(AsioStream *stream, const char *name)
+{
+    const char *client = pjack_get_client_name(stream->client);
+    size_t len = strlen(client);
+    
+    return !strncmp(name, client, len) && name[len] == ':';
+}
+
+/* Enumerate one direction's peer ports, physical ones first so they keep
+ * their order for autoconnect. The registration callback may have added
+ * some already; port_map_add keeps their slots. */
+static void enumerate_peers(AsioStream *stream, PortMap *map, unsigned long flags)
+{
+    const char **physical = pjack_get_ports(stream->client, NULL, JACK_DEFAULT_AUDIO_TYPE,
+                                            JackPortIsPhysical | flags);
+    const char **ports = stream->num_routes ?
+        pjack_get_ports(stream->client, NULL, JACK_DEFAULT_AUDIO_TYPE, flags) : NULL;
+    int i;
+    
+    pthread_mutex_lock(&stream->connect_mutex);
+    for (i = 0; physical && physical[i]; i++)
+        port_map_add(map, physical[i], TRUE);
+    for (i = 0; ports && ports[i]; i++)
+        if (!own_port(stream, ports[i]))
+            port_map_add(map, ports[i], FALSE);
+    pthread_mutex_unlock(&stream->connect_mutex);
+    if (physical)
+        pjack_free(physical);
+    if (ports)
+        pjack_free(ports);
+}
+
+/* Queue a planned connection unless it exists or an end is missing */
+static void plan_connection(AsioStream *stream, Connection **plan, int *count, int *capacity,
+                            BOOL is_input, int channel, int peer)
+{
+    const IOChannel *channels = is_input ? stream->inputs : stream->outputs;
+    const PortMap *map = is_input ? &stream->peers_in : &stream->peers_out;
+    
+    if (channels[channel].port && map->ports[peer].present &&
+        find_connection(stream, is_input, channel, peer) < 0)
+        add_connection(plan, count, capacity, is_input, channel, peer);
+}
+
+/* The connections one direction is missing, under connect_mutex: the
+ * routing map's, then channel i to the i-th physical port for channels
+ * no rule covers */
+static void plan_direction(AsioStream *stream, BOOL is_input, Connection **plan, int *count, int *capacity)
+{
+    const PortMap *map = is_input ? &stream->peers_in : &stream->peers_out;
+    int num = is_input ? stream->num_inputs : stream->num_outputs;
+    int i, p, channel;
+    
+    for (i = 0; i < stream->num_routes; i++) {
+        const Route *route = &stream->routes[i];
+        
+        if (route->is_input != is_input)
+            continue;
+        for (p = 0, channel = route->first; p < map->count && channel <= route->last; p++) {
+            if (!route_matches(route, map->ports[p].name))
+                continue;
+            plan_connection(stream, plan, count, capacity, is_input, channel, p);
+            if (route->first != route->last)
+                channel++;
+        }
+    }
+    
+    if (!stream->autoconnect)
+        return;
+    for (p = 0, channel = 0; p < map->count && channel < num; p++) {
+        if (!map->ports[p].physical)
+            continue;
+        if (!channel_routed(stream, is_input, channel))
+            plan_connection(stream, plan, count, capacity, is_input, channel, p);
+        channel++;
+    }
+}
+
+/* Make one planned connection. Names are copied under connect_mutex and
+ * jack_connect, a server round trip, is called without it. */
+static void make_connection(AsioStream *stream, const Connection *c)
+{
+    IOChannel *io = c->is_input ? &stream->inputs[c->channel] : &stream->outputs[c->channel];
+    PortMap *map = c->is_input ? &stream->peers_in : &stream->peers_out;
+    char own[JACK_PORT_NAME_SIZE], peer[JACK_PORT_NAME_SIZE];
+    jack_port_t *port;
+    int err;
+    
+    pthread_mutex_lock(&stream->connect_mutex);
+    port = io->port;
+    if (!port || !map->ports[c->peer].present) {
+        pthread_mutex_unlock(&stream->connect_mutex);
+        return;
+    }
+    snprintf(own, sizeof(own), "%s", pjack_port_name(port));
+    snprintf(peer, sizeof(peer), "%s", map->ports[c->peer].name);
+    pthread_mutex_unlock(&stream->connect_mutex);
+    
+    err = c->is_input ? pjack_connect(stream->client, peer, own)
+                      : pjack_connect(stream->client, own, peer);
+    
+    pthread_mutex_lock(&stream->connect_mutex);
+    if ((!err || err == EEXIST) && io->port == port && map->ports[c->peer].present &&
+        find_connection(stream, c->is_input, c->channel, c->peer) < 0)
+        add_connection(&stream->connections, &stream->num_connections, &stream->connections_capacity,
+                       c->is_input, c->channel, c->peer);
+    pthread_mutex_unlock(&stream->connect_mutex);
+    if (err && err != EEXIST)
+        WARN("Could not connect %s to %s\n", c->is_input ? peer : own, c->is_input ? own : peer);
+}
+
+/* One pass: plan all missing connections, then make them in one batch */
+static void apply_connections(AsioStream *stream)
+{
+    Connection *plan = NULL;
+    int count = 0, capacity = 0, i;
+    
+    if (!stream->ports_enumerated) {
+        enumerate_peers(stream, &stream->peers_in, JackPortIsOutput);
+        enumerate_peers(stream, &stream->peers_out, JackPortIsInput);
+        stream->ports_enumerated = TRUE;
+    }
+    
+    pthread_mutex_lock(&stream->connect_mutex);
+    plan_direction(stream, TRUE, &plan, &count, &capacity);
+    plan_direction(stream, FALSE, &plan, &count, &capacity);
+    pthread_mutex_unlock(&stream->connect_mutex);
+    
+    for (i = 0; i < count; i++)
+        make_connection(stream, &plan[i]);
+    free(plan);
+}
+
+/* Autoconnect worker: applies the plan whenever its generation changes */
+static void *connect_thread(void *arg)
+{
+    AsioStream *stream = arg;
+    UINT32 generation;
+    
+    pthread_mutex_lock(&stream->connect_mutex);
+    while (!stream->connect_quit) {
+        if (stream->connect_applied == stream->connect_requested) {
+            pthread_cond_wait(&stream->connect_cond, &stream->connect_mutex);
+            continue;
+        }
+        generation = stream->connect_requested;
+        pthread_mutex_unlock(&stream->connect_mutex);
+        
+        apply_connections(stream);
+        
+        pthread_mutex_lock(&stream->connect_mutex);
+        stream->connect_applied = generation;
+        publish_connections(stream);
+        pthread_cond_broadcast(&stream->connect_cond);
+    }
+    pthread_mutex_unlock(&stream->connect_mutex);
+    return NULL;
+}
+
+/* Ask for the plan to be applied: channel ports were registered. Without
+ * the worker (thread creation failed) it is applied here. */
+static void request_connections(AsioStream *stream)
+{
+    pthread_mutex_lock(&stream->connect_mutex);
+    if (wants_connections(stream))
+        stream->connect_requested++;
+    publish_connections(stream);
+    pthread_cond_broadcast(&stream->connect_cond);
+    pthread_mutex_unlock(&stream->connect_mutex);
+    
+    if (wants_connections(stream) && !stream->connect_thread_running) {
+        apply_connections(stream);
+        pthread_mutex_lock(&stream->connect_mutex);
+        stream->connect_applied = stream->connect_requested;
+        publish_connections(stream);
+        pthread_mutex_unlock(&stream->connect_mutex);
+    }
+}
+
+/* Wait up to timeout milliseconds for the worker to apply the plan */
+static BOOL wait_connections(AsioStream *stream, LONG timeout)
+{
+    struct timespec deadline;
+    BOOL ready;
+    
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    
+    pthread_mutex_lock(&stream->connect_mutex);
+    while (stream->connect_applied != stream->connect_requested && !stream->connect_quit && timeout > 0 &&
+           pthread_cond_timedwait(&stream->connect_cond, &stream->connect_mutex, &deadline) != ETIMEDOUT);
+    ready = stream->connect_applied == stream->connect_requested;
+    pthread_mutex_unlock(&stream->connect_mutex);
+    return ready;
+}
+
+/* New peer port wanted by the plan: a physical port for autoconnect or a
+ * match of a routing rule */
+static BOOL peer_wanted(const AsioStream *stream, BOOL is_input, const PeerPort *peer)
+{
+    int i;
+    
+    if (peer->physical && stream->autoconnect)
+        return TRUE;
+    for (i = 0; i < stream->num_routes; i++)
+        if (stream->routes[i].is_input == is_input && route_matches(&stream->routes[i], peer->name))
+            return TRUE;
+    return FALSE;
+}
+
+/* JACK port registration callback (JACK notification thread): keeps the
+ * peer port maps current. A port the plan wants triggers a pass of the
+ * worker; connections to a port that went away are made again when it
+ * comes back. */
+static void jack_port_registration_callback(jack_port_id_t id, int registered, void *arg)
+{
+    AsioStream *stream = arg;
+    jack_port_t *port = pjack_port_by_id(stream->client, id);
+    const char *type, *name;
+    PortMap *map;
+    BOOL is_input;
+    int flags, index;
+    
+    if (!port)
+        return;
+    flags = pjack_port_flags(port);
+    type = pjack_port_type(port);
+    name = pjack_port_name(port);
+    if (!type || strcmp(type, JACK_DEFAULT_AUDIO_TYPE) || !name || own_port(stream, name))
+        return;
+    if (!(flags & JackPortIsPhysical) && !stream->num_routes)
+        return;
+    
+    /* Ports that output audio feed the inputs */
+    is_input = (flags & JackPortIsOutput) != 0;
+    map = is_input ? &stream->peers_in : &stream->peers_out;
+    
+    pthread_mutex_lock(&stream->connect_mutex);
+    if (registered) {
+        if ((index = port_map_add(map, name, (flags & JackPortIsPhysical) != 0)) >= 0 &&
+            peer_wanted(stream, is_input, &map->ports[index])) {
+            stream->connect_requested++;
+            publish_connections(stream);
+            pthread_cond_broadcast(&stream->connect_cond);
+        }
+    } else if ((index = port_map_find(map, name)) >= 0) {
+        map->ports[index].present = FALSE;
+        drop_connections(stream, is_input, -1, index);
+    }
+    pthread_mutex_unlock(&stream->connect_mutex);
+}
+
+/* Register a channel's JACK port. Returns TRUE if it was newly registered. */
+static BOOL register_port(AsioStream *stream, BOOL is_input, int index)
+{
+    IOChannel *io = is_input ? &stream->inputs[index] : &stream->outputs[index];
+    jack_port_t *port;
+    
+    if (io->port)
+        return FALSE;
+    port = pjack_port_register(stream->client, io->name, JACK_DEFAULT_AUDIO_TYPE,
+                               is_input ? JackPortIsInput : JackPortIsOutput, 0);
+    if (!port) {
+        WARN("Could not register JACK port %s\n", io->name);
+        return FALSE;
+    }
+    pthread_mutex_lock(&stream->connect_mutex);
+    io->port = port;
+    pthread_mutex_unlock(&stream->connect_mutex);
+    return TRUE;
+}
+
+/* Wait until no JACK cycle can still hold a port pointer cleared before
+ * the call. A cycle inside its port section when we look finishes it;
+ * later ones load the cleared slots. Gives up after a second of a stalled
+ * cycle. */
+static BOOL quiesce_ports(AsioStream *stream)
+{
+    UINT32 seq = __atomic_load_n(&stream->port_seq, __ATOMIC_SEQ_CST);
+    int i;
+    
+    for (i = 0; (seq & 1) && __atomic_load_n(&stream->port_seq, __ATOMIC_ACQUIRE) == seq; i++) {
+        if (i == 10000)
+            return FALSE;
+        usleep(100);
+    }
+    return TRUE;
+}
+
+/* Clear a channel's port and queue it for release_retired_ports. A
+ * stopped stream's cycle still reads the IOChannel slots, and the connect
+ * worker may be about to connect it. */
+static void retire_port(AsioStream *stream, BOOL is_input, int index)
+{
+    IOChannel *io = is_input ? &stream->inputs[index] : &stream->outputs[index];
+    jack_port_t *port = io->port;
+    
+    if (!port)
+        return;
+    if (stream->num_retired == stream->retired_capacity) {
+        int capacity = stream->retired_capacity ? 2 * stream->retired_capacity : 16;
+        jack_port_t **retired = realloc(stream->retired, capacity * sizeof(*retired));
+        
+        if (!retired) {
+            WARN("Out of memory, keeping JACK port %s\n", io->name);
+            return;
+        }
+        stream->retired = retired;
+        stream->retired_capacity = capacity;
+    }
+    pthread_mutex_lock(&stream->connect_mutex);
+    __atomic_store_n(&io->port, NULL, __ATOMIC_SEQ_CST);
+    drop_connections(stream, is_input, index, -1);
+    pthread_mutex_unlock(&stream->connect_mutex);
+    stream->retired[stream->num_retired++] = port;
+}
+
+/* Unregister the retired ports once the cycle has let go of them. If it
+ * is stalled they stay queued for the next call or close_stream. */
+static void release_retired_ports(AsioStream *stream)
+{
+    int i;
+    
+    if (!stream->num_retired)
+        return;
+    if (!quiesce_ports(stream)) {
+        WARN("JACK cycle stalled, deferring unregistration of %d ports\n", stream->num_retired);
+        return;
+    }
+    for (i = 0; i < stream->num_retired; i++)
+        pjack_port_unregister(stream->client, stream->retired[i]);
+    stream->num_retired = 0;
+}
+
+/* First registered port - with lazy ports, channel 0 may have none */
+static jack_port_t *first_port(const IOChannel *channels, int count)
+{
+    int i;
+    
+    for (i = 0; i < count; i++)
+        if (channels[i].port)
+            return channels[i].port;
+    return NULL;
+}
+
+/* Lazy ports: keep ports for the active channels only. New ports are
+ * connected by the connect worker; the others are unregistered together
+ * once the cycle has let go of them. */
+static void update_lazy_ports(AsioStream *stream)
+{
+    BOOL added = FALSE;
+    int i;
+    
+    if (!stream->lazy_ports)
+        return;
+    
+    for (i = 0; i < stream->num_inputs; i++) {
+        if (!stream->inputs[i].active)
+            retire_port(stream, TRUE, i);
+        else
+            added |= register_port(stream, TRUE, i);
+    }
+    for (i = 0; i < stream->num_outputs; i++) {
+        if (!stream->outputs[i].active)
+            retire_port(stream, FALSE, i);
+        else
+            added |= register_port(stream, FALSE, i);
+    }
+    release_retired_ports(stream);
+    if (added)
+        request_connections(stream);
+}
+
+/* Allocate the channel arrays for the configured counts. The active
+ * channel tables share one block, so locking them takes one region. */
+static BOOL alloc_channels(AsioStream *stream)
+{
+    SIZE_T active = sizeof(ActiveChannel) * (stream->num_inputs + stream->num_outputs);
+    
+    stream->inputs = calloc(stream->num_inputs, sizeof(IOChannel));
+    stream->outputs = calloc(stream->num_outputs, sizeof(IOChannel));
+    stream->tables_size = active + sizeof(jack_port_t *) * stream->num_outputs;
+    stream->active_in = calloc(1, stream->tables_size);
+    stream->locked = calloc(LOCKED_REGIONS(stream), sizeof(*stream->locked));
+    if (!stream->inputs || !stream->outputs || !stream->active_in || !stream->locked)
+        return FALSE;
+    
+    stream->active_out = stream->active_in + stream->num_inputs;
+    stream->idle_out = (jack_port_t **)(stream->active_out + stream->num_outputs);
+    return TRUE;
+}
+
+static void free_channels(AsioStream *stream)
+{
+    free(stream->inputs);
+    free(stream->outputs);
+    free(stream->active_in);
+    free(stream->locked);
+    stream->inputs = stream->outputs = NULL;
+    stream->active_in = stream->active_out = NULL;
+    stream->idle_out = NULL;
+    stream->locked = NULL;
+}
+
+/* Pack the active channels that have a port and both buffer halves into
+ * the tables the JACK cycle walks. Called while the stream is not running. */
+static void build_active_channels(AsioStream *stream)
+{
+    int i;
+    
+    stream->num_active_in = stream->num_active_out = stream->num_idle_out = 0;
+    
+    for (i = 0; i < stream->num_inputs; i++) {
+        IOChannel *io = &stream->inputs[i];
+        ActiveChannel *ch = &stream->active_in[stream->num_active_in];
+        
+        if (!io->active || !io->port || !io->pe_buffer[0] || !io->pe_buffer[1])
+            continue;
+        if (stream->ring_periods && !io->ring)
+            continue;
+        ch->port = io->port;
+        ch->pe_buffer[0] = io->pe_buffer[0];
+        ch->pe_buffer[1] = io->pe_buffer[1];
+        ch->ring = io->ring;
+        asio_dither_init(&ch->dither, i + 1);
+        stream->num_active_in++;
+    }
+    
+    for (i = 0; i < stream->num_outputs; i++) {
+        IOChannel *io = &stream->outputs[i];
+        ActiveChannel *ch = &stream->active_out[stream->num_active_out];
+        
+        if (!io->port)
+            continue;
+        if (!io->active || !io->pe_buffer[0] || !io->pe_buffer[1] || (stream->ring_periods && !io->ring)) {
+            stream->idle_out[stream->num_idle_out++] = io->port;
+            continue;
+        }
+        ch->port = io->port;
+        ch->pe_buffer[0] = io->pe_buffer[0];
+        ch->pe_buffer[1] = io->pe_buffer[1];
+        ch->ring = io->ring;
+        stream->num_active_out++;
+    }
+}
+
+static void free_rings(AsioStream *stream)
+{
+    int i;
+    
+    for (i = 0; i < stream->num_inputs; i++) {
+        free(stream->inputs[i].ring);
+        stream->inputs[i].ring = NULL;
+    }
+    for (i = 0; i < stream->num_outputs; i++) {
+        free(stream->outputs[i].ring);
+        stream->outputs[i].ring = NULL;
+    }
+    stream->ring_periods = 0;
+}
+
+/* One JACK cycle in the process callback modes */
+static void run_cycle(AsioStream *stream, jack_nframes_t nframes)
+{
+    LONG buffer_index = stream->buffer_index;
+    BOOL sync = stream->process_mode == WINEASIO_PROCESS_SYNC;
+    
+    if (stream->state != Running) {
+        /* Output silence */
+        copy_outputs(stream, -1, nframes);
+        publish_status(stream, buffer_index, FALSE);
+        return;
+    }
+    
+    if (stream->ring_periods) {
+        /* Safety periods - the callback thread moves the host's buffers */
+        ring_process(stream, nframes);
+    } else {
+        copy_inputs(stream, buffer_index, nframes);
+    }
+    
+    if (!sync && !stream->ring_periods) {
+        /* The host should have finished the previous buffer switch by now */
+        if (__atomic_load_n(&stream->done_position, __ATOMIC_ACQUIRE) != stream->sample_position)
+            note_host_overrun(stream);
+        
+        if (!stream->output_ready) {
+            /* Send what the host wrote into this buffer two switches ago */
+            copy_outputs(stream, buffer_index, nframes);
+        } else if (stream->sample_position &&
+                   __atomic_load_n(&stream->ready_position, __ATOMIC_ACQUIRE) == stream->sample_position) {
+            /* The host called OutputReady for the previous switch - send that
+             * buffer now, one period earlier. Both halves are settled: the
+             * host is done with this one and has not been given the other. */
+            copy_outputs(stream, stream->ready_index, nframes);
+        } else {
+            /* Not finished - silence rather than a half-written buffer */
+            copy_outputs(stream, -1, nframes);
+        }
+    }
+    
+    /* Update sample position */
+    stream->sample_position += nframes;
+    stream->system_time = get_system_time();
+    publish_status(stream, buffer_index, FALSE);
+    
+    /* Drop stale acknowledgements before asking for a new buffer */
+    if (sync)
+        while (sem_trywait(&stream->done_sem) == 0);
+    
+    /* Signal buffer switch to PE side */
+    push_event(stream, ASIO_EVENT_BUFFER_SWITCH, buffer_index, stream->sample_rate);
+    
+    /* Sync mode: the host processes this buffer within the current cycle */
+    if (sync) {
+        if (wait_for_host(stream, nframes)) {
+            copy_outputs(stream, buffer_index, nframes);
+        } else {
+            copy_outputs(stream, -1, nframes);
+            note_host_overrun(stream);
+        }
+    }
+    
+    /* Switch buffers */
+    stream->buffer_index = buffer_index ? 0 : 1;
+}
+
+/* JACK process callback - runs in realtime thread */
+static int jack_process_callback(jack_nframes_t nframes, void *arg)
+{
+    AsioStream *stream = (AsioStream *)arg;
+    
+    enter_port_section(stream);
+    run_cycle(stream, nframes);
+    leave_port_section(stream);
+    return 0;
+}
+
+static inline BOOL pe_owns_cycle(AsioStream *stream)
+{
+    return __atomic_load_n(&stream->cycle_owner, __ATOMIC_ACQUIRE) == CYCLE_PE;
+}
+
+/* Finish a cycle started by asio_process_cycle: send the host's output and
+ * let the JACK graph continue */
+static void finish_cycle(AsioStream *stream)
+{
+    enter_port_section(stream);
+    copy_outputs(stream, stream->state == Running ? stream->open_index : -1, stream->open_nframes);
+    leave_port_section(stream);
+    pjack_cycle_signal(stream->client, 0);
+    stream->cycle_open = FALSE;
+}
+
+/* JACK process thread used in direct mode.
+ * JACK runs this in its realtime thread. Unix code cannot call into the
+ * host, so while the PE callback thread is attached this thread parks and
+ * the PE thread calls jack_cycle_wait/jack_cycle_signal itself (through
+ * asio_process_cycle). Only one of the two threads runs the cycle at a
+ * time; ownership changes between jack_cycle_signal and the next wait. */
+static void *jack_process_thread(void *arg)
+{
+    AsioStream *stream = (AsioStream *)arg;
+    jack_nframes_t nframes;
+    LONG requested;
+    
+    for (;;) {
+        if (pe_owns_cycle(stream)) {
+            sem_wait(&stream->handoff_sem);
+            continue;
+        }
+        
+        nframes = pjack_cycle_wait(stream->client);
+        /* Not attached - nobody processes the host buffers */
+        enter_port_section(stream);
+        copy_outputs(stream, -1, nframes);
+        leave_port_section(stream);
+        publish_status(stream, stream->buffer_index, FALSE);
+        pjack_cycle_signal(stream->client, 0);
+        
+        requested = CYCLE_REQUESTED;
+        if (__atomic_compare_exchange_n(&stream->cycle_owner, &requested, CYCLE_PE, FALSE,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            sem_post(&stream->attach_sem);
+    }
+    
+    return NULL;
+}
+
+/* JACK buffer size callback */
+static int jack_buffer_size_callback(jack_nframes_t nframes, void *arg)
+{
+    AsioStream *stream = (AsioStream *)arg;
+    
+    TRACE("Buffer size changed to %u\n", nframes);
+    
+    /* JACK also calls this on activation - only a real change needs a reset */
+    if ((LONG)nframes == stream->buffer_size)
+        return 0;
+    
+    stream->buffer_size = nframes;
+    
+    /* A period the buffers hold is taken in place - the cycle uses the
+     * same buffers for nframes at once and the host is asked to follow
+     * with kAsioBufferSizeChange. The safety rings are sized per period,
+     * so they still need new buffers. */
+    if (stream->state >= Prepared && (LONG)nframes <= stream->buffer_frames && !stream->ring_periods)
+        push_event(stream, ASIO_EVENT_BUFFER_SIZE, -1, (double)nframes);
+    else
+        push_event(stream, ASIO_EVENT_RESET, -1, (double)nframes);
+    
+    return 0;
+}
+
+/* JACK sample rate callback */
+static int jack_sample_rate_callback(jack_nframes_t nframes, void *arg)
+{
+    AsioStream *stream = (AsioStream *)arg;
+    
+    TRACE("Sample rate changed to %u\n", nframes);
+    
+    stream->sample_rate = (double)nframes;
+    push_event(stream, ASIO_EVENT_SAMPLE_RATE, -1, (double)nframes);
+    
+    return 0;
+}
+
+/* JACK latency callback */
+static void jack_latency_callback(jack_latency_callback_mode_t mode, void *arg)
+{
+    AsioStream *stream = (AsioStream *)arg;
+    
+    /* JACK recomputes both directions in turn - report the change once */
+    if (mode == JackPlaybackLatency)
+        push_event(stream, ASIO_EVENT_LATENCY, -1, 0.0);
+}
+
+static AsioStream *handle_to_stream(asio_handle h)
+{
+    return (AsioStream *)(UINT_PTR)h;
+}
+
+/*
+ * Unix function implementations
+ */
+
+/* JACK xrun callback - runs in JACK's notification thread */
+static int jack_xrun_callback(void *arg)
+{
+    AsioStream *stream = (AsioStream *)arg;
+    float delayed = pjack_get_xrun_delayed_usecs ? pjack_get_xrun_delayed_usecs(stream->client) : 0.0f;
+    
+    __atomic_fetch_add(&stream->jack_xruns, 1, __ATOMIC_RELAXED);
+    if (stream->state == Running)
+        push_event(stream, ASIO_EVENT_XRUN, -1, delayed);
+    
+    return 0;
+}
+
+/* Parse a CPU list such as "2,3" or "4-7,12". Returns the number of CPUs
+ * in the set, or -1 if the list is malformed. */
+static int parse_cpu_list(const char *str, cpu_set_t *set)
+{
+    const char *p = str;
+    char *end;
+    long first, last, cpu;
+    
+    CPU_ZERO(set);
+    
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        if (!*p)
+            break;
+        
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return -1;
+        last = first;
+        p = end;
+        
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+            p = end;
+        }
+        if (last >= CPU_SETSIZE)
+            return -1;
+        
+        for (cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        
+        while (*p == ' ') p++;
+        if (*p && *p != ',')
+            return -1;
+    }
+    
+    return CPU_COUNT(set);
+}
+
+/* Flush denormals to zero on the calling thread. Decaying signals would
+ * otherwise hit the slow microcode path for denormal operands. */
+static void set_denormal_mode(AsioStream *stream)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (stream->denormal_protect)
+        _mm_setcsr(_mm_getcsr() | WINEASIO_MXCSR_FTZ | WINEASIO_MXCSR_DAZ);
+#endif
+}
+
+static void free_buffer_arena(AsioStream *stream)
+{
+    SIZE_T size = 0;
+    
+    if (!stream->arena_base)
+        return;
+    
+    pNtFreeVirtualMemory(NtCurrentProcess(), &stream->arena_base, &size, MEM_RELEASE);
+    stream->arena_base = NULL;
+    stream->arena = NULL;
+    stream->arena_size = 0;
+}
+
+/* mlock a region the JACK cycle touches, which faults its pages in, so
+ * the RT threads never take a page fault on it. A region mlock refused is
+ * read page by page instead and counts as a failure. */
+static void lock_region(AsioStream *stream, void *addr, SIZE_T size)
+{
+    UINT_PTR page = sysconf(_SC_PAGESIZE);
+    UINT_PTR start = (UINT_PTR)addr & ~(page - 1);
+    UINT_PTR end = ((UINT_PTR)addr + size + page - 1) & ~(page - 1);
+    UINT_PTR p;
+    
+    if (!addr || !size)
+        return;
+    
+    if (stream->num_locked < LOCKED_REGIONS(stream) && !mlock((void *)start, end - start)) {
+        stream->locked[stream->num_locked].addr = (void *)start;
+        stream->locked[stream->num_locked].size = end - start;
+        stream->num_locked++;
+    } else {
+        if (!stream->lock_failures)
+            WARN("Could not lock %lu bytes of audio memory (%s), raise RLIMIT_MEMLOCK "
+                 "(ulimit -l) to avoid page faults in the JACK thread\n",
+                 (unsigned long)(end - start), strerror(errno));
+        stream->lock_failures++;
+    }
+    
+    /* mlock has faulted the pages in; without it, read them in. Never
+     * write: the status block, the event queue and the PE object are live
+     * shared state. */
+    for (p = start; p < end; p += page)
+        (void)*(volatile const char *)p;
+}
+
+static void unlock_memory(AsioStream *stream)
+{
+    int i;
+    
+    for (i = 0; i < stream->num_locked; i++)
+        munlock(stream->locked[i].addr, stream->locked[i].size);
+    stream->num_locked = 0;
+}
+
+/* Lock everything the JACK cycle dereferences: the stream, the status
+ * block, the buffer halves (wherever they were allocated), the safety
+ * rings and the PE driver object holding the host's ASIOTime. */
+static void lock_memory(AsioStream *stream, const struct asio_buffer_info *infos, LONG num_channels,
+                        void *pe_state, SIZE_T pe_state_size)
+{
+    SIZE_T bytes = (SIZE_T)stream->conv.sample_size * stream->buffer_frames;
+    UINT_PTR lo = ~(UINT_PTR)0, hi = 0;
+    int i, j;
+    
+    unlock_memory(stream);
+    if (!stream->lock_memory)
+        return;
+    
+    lock_region(stream, stream, sizeof(*stream));
+    lock_region(stream, stream->status, sizeof(*stream->status));
+    lock_region(stream, stream->active_in, stream->tables_size);
+    lock_region(stream, pe_state, pe_state_size);
+    
+    /* Both arena layouts are one contiguous block */
+    for (i = 0; i < num_channels; i++) {
+        for (j = 0; j < 2; j++) {
+            UINT_PTR buf = (UINT_PTR)infos[i].buffer_ptr[j];
+            if (buf < lo) lo = buf;
+            if (buf + bytes > hi) hi = buf + bytes;
+        }
+    }
+    if (hi > lo)
+        lock_region(stream, (void *)lo, hi - lo);
+    
+    if (stream->ring_periods) {
+        SIZE_T ring_size = sizeof(jack_default_audio_sample_t) * stream->ring_periods * stream->ring_frames;
+        for (i = 0; i < stream->num_inputs; i++)
+            lock_region(stream, stream->inputs[i].ring, ring_size);
+        for (i = 0; i < stream->num_outputs; i++)
+            lock_region(stream, stream->outputs[i].ring, ring_size);
+    }
+    
+    TRACE("Locked %d memory regions, %u failures in this session\n", stream->num_locked,
+          (unsigned int)stream->lock_failures);
+}
+
+/* Back the huge-page-aligned arena with explicit huge pages. They are
+ * mapped elsewhere first and moved into place, so a failure (no pages
+ * reserved in /proc/sys/vm/nr_hugepages) leaves the arena intact. */
+static BOOL map_explicit_huge_pages(char *arena, SIZE_T size)
+{
+    void *huge = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    
+    if (huge == MAP_FAILED)
+        return FALSE;
+    if (mremap(huge, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, arena) == MAP_FAILED) {
+        munmap(huge, size);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Allocate the buffer arena in the PE-visible address space (below 2 GB
+ * for a WoW64 host) and lay the channel buffers out in it. With huge
+ * pages, the buffers start on a huge page boundary so a 2 MB page covers
+ * as many of them as possible. */
+static BOOL alloc_buffer_arena(AsioStream *stream, struct asio_buffer_info *infos,
+                               LONG num_channels, LONG buffer_size, BOOL low_address)
+{
+    UINT64 stride = asio_buffer_stride(stream->conv.sample_size, buffer_size, stream->page_align_buffers);
+    SIZE_T size = 2 * num_channels * stride;
+    SIZE_T alloc = size;
+    const char *backing = "normal pages";
+    NTSTATUS status;
+    
+    free_buffer_arena(stream);
+    if (!load_ntdll())
+        return FALSE;
+    
+    if (stream->huge_pages != WINEASIO_HUGE_PAGES_OFF) {
+        size = (size + HUGE_PAGE_SIZE - 1) & ~(SIZE_T)(HUGE_PAGE_SIZE - 1);
+        alloc = size + HUGE_PAGE_SIZE;
+    }
+    
+    status = pNtAllocateVirtualMemory(NtCurrentProcess(), &stream->arena_base, low_address ? 0x7fffffff : 0,
+                                      &alloc, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (status) {
+        WARN("Could not allocate %lu byte buffer arena: %#x\n", (unsigned long)alloc, (unsigned int)status);
+        stream->arena_base = NULL;
+        return FALSE;
+    }
+    
+    stream->arena = stream->arena_base;
+    stream->arena_size = size;
+    
+    if (stream->huge_pages != WINEASIO_HUGE_PAGES_OFF) {
+        stream->arena = (char *)(((UINT_PTR)stream->arena_base + HUGE_PAGE_SIZE - 1) & ~(UINT_PTR)(HUGE_PAGE_SIZE - 1));
+        
+        if (stream->huge_pages == WINEASIO_HUGE_PAGES_EXPLICIT && map_explicit_huge_pages(stream->arena, size))
+            backing = "explicit huge pages";
+        else if (!madvise(stream->arena, size, MADV_HUGEPAGE))
+            backing = "transparent huge pages";
+        else
+            WARN("Transparent huge pages not available: %s\n", strerror(errno));
+        
+        if (stream->huge_pages == WINEASIO_HUGE_PAGES_EXPLICIT && strcmp(backing, "explicit huge pages"))
+            WARN("No explicit huge pages available (see /proc/sys/vm/nr_hugepages), using %s\n", backing);
+    }
+    
+    asio_buffer_layout(infos, num_channels, (UINT64)(UINT_PTR)stream->arena, stride);
+    
+    TRACE("Buffer arena at %p: %lu byte stride, %lu bytes, %s\n", stream->arena,
+          (unsigned long)stride, (unsigned long)size, backing);
+    return TRUE;
+}
+
+/* Thread init callback - JACK calls it in its process thread before the
+ * first cycle, so the JACK side of the buffer switch shares the callback
+ * thread's cores and caches and runs with denormal protection */
+static void jack_thread_init(void *arg)
+{
+    AsioStream *stream = (AsioStream *)arg;
+    int err;
+    
+    set_denormal_mode(stream);
+    
+    if (!stream->pin_jack_thread || stream->num_cpus <= 0)
+        return;
+    
+    err = pthread_setaffinity_np(pthread_self(), sizeof(stream->cpu_set), &stream->cpu_set);
+    if (err)
+        WARN("Could not pin JACK process thread to CPUs %s: %s\n", stream->cpu_list, strerror(err));
+}
+
+/* Free the buffers of CreateBuffers and return to the Initialized state */
+static void dispose_buffers(AsioStream *stream)
+{
+    int i;
+    
+    if (stream->state == Running) {
+        stream->state = Prepared;
+    }
+    
+    unlock_memory(stream);
+    free_rings(stream);
+    
+    /* Free buffers and mark inactive */
+    for (i = 0; i < stream->num_inputs; i++) {
+        free(stream->inputs[i].audio_buffer);
+        stream->inputs[i].audio_buffer = NULL;
+        stream->inputs[i].active = FALSE;
+    }
+    for (i = 0; i < stream->num_outputs; i++) {
+        free(stream->outputs[i].audio_buffer);
+        stream->outputs[i].audio_buffer = NULL;
+        stream->outputs[i].active = FALSE;
+    }
+    build_active_channels(stream);
+    update_lazy_ports(stream);
+    free_buffer_arena(stream);
+    stream->buffer_frames = 0;
+    
+    stream->state = Initialized;
+}
+
+/* Close the JACK client and free the stream */
+static void close_stream(AsioStream *stream)
+{
+    int i;
+    
+    /* The worker may be in jack_connect, finish it before the client goes */
+    if (stream->connect_thread_running) {
+        pthread_mutex_lock(&stream->connect_mutex);
+        stream->connect_quit = TRUE;
+        pthread_cond_broadcast(&stream->connect_cond);
+        pthread_mutex_unlock(&stream->connect_mutex);
+        pthread_join(stream->connect_thread, NULL);
+    }
+    
+    /* Deactivate and close */
+    if (stream->client) {
+        pjack_deactivate(stream->client);
         
         /* Unregister audio ports */
         for (i = 0; i < stream->num_inputs; i++) {
@@ -543,27 +2116,449 @@ static NTSTATUS asio_exit(void *args)
             if (stream->outputs[i].port)
                 pjack_port_unregister(stream->client, stream->outputs[i].port);
         }
+        for (i = 0; i < stream->num_retired; i++)
+            pjack_port_unregister(stream->client, stream->retired[i]);
+        
+        pjack_client_close(stream->client);
+    }
+    
+    /* Free peer port maps and the routing map */
+    port_map_free(&stream->peers_in);
+    port_map_free(&stream->peers_out);
+    free(stream->connections);
+    free(stream->retired);
+    free_routes(stream);
+    pthread_cond_destroy(&stream->connect_cond);
+    pthread_mutex_destroy(&stream->connect_mutex);
+    
+    /* Free audio buffers */
+    for (i = 0; i < stream->num_inputs; i++)
+        free(stream->inputs[i].audio_buffer);
+    for (i = 0; i < stream->num_outputs; i++)
+        free(stream->outputs[i].audio_buffer);
+    
+    free(stream->callback_audio_buffer);
+    unlock_memory(stream);
+    free_rings(stream);
+    free_buffer_arena(stream);
+    
+    sem_destroy(&stream->callback_sem);
+    sem_destroy(&stream->done_sem);
+    sem_destroy(&stream->attach_sem);
+    sem_destroy(&stream->handoff_sem);
+    
+    free_channels(stream);
+    free(stream);
+}
+
+/* Keep-alive: asio_exit parks an idle stream, JACK client, ports and
+ * connections intact, for keep_alive milliseconds. asio_init reattaches it
+ * if the configuration is unchanged; otherwise reaper_thread closes it. */
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+static AsioStream *parked_stream;
+static struct timespec park_deadline;   /* CLOCK_REALTIME, for pthread_cond_timedwait */
+static BOOL reaper_running;
+
+/* Closes the parked stream once its grace period is over */
+static void *reaper_thread(void *arg)
+{
+    AsioStream *stream;
+    struct timespec now;
+    
+    pthread_mutex_lock(&park_mutex);
+    while (parked_stream) {
+        if (pthread_cond_timedwait(&park_cond, &park_mutex, &park_deadline) != ETIMEDOUT)
+            continue;
+        /* A stream parked meanwhile moved the deadline */
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec < park_deadline.tv_sec ||
+            (now.tv_sec == park_deadline.tv_sec && now.tv_nsec < park_deadline.tv_nsec))
+            continue;
+        stream = parked_stream;
+        parked_stream = NULL;
+        pthread_mutex_unlock(&park_mutex);
+        
+        TRACE("Closing parked JACK client %s\n", stream->client_name);
+        close_stream(stream);
+        
+        pthread_mutex_lock(&park_mutex);
+    }
+    reaper_running = FALSE;
+    pthread_mutex_unlock(&park_mutex);
+    
+    return NULL;
+}
+
+/* Wait until no thread holds a reference to the status block taken
+ * before it was cleared - at most a second */
+static BOOL release_status(AsioStream *stream)
+{
+    int i;
+    
+    for (i = 0; __atomic_load_n(&stream->status_refs, __ATOMIC_ACQUIRE); i++) {
+        if (i == 10000)
+            return FALSE;
+        usleep(100);
+    }
+    return TRUE;
+}
+
+/* Park the stream instead of closing it. Returns FALSE if keep-alive is off
+ * or the stream cannot be parked. */
+static BOOL park_stream(AsioStream *stream)
+{
+    AsioStream *old;
+    pthread_t thread;
+    LONG keep_alive = stream->config.keep_alive;
+    
+    if (keep_alive <= 0 || !stream->client || pe_owns_cycle(stream))
+        return FALSE;
+    
+    if (stream->state >= Prepared)
+        dispose_buffers(stream);
+    stream->state = Loaded;
+    
+    /* The PE side frees the status block after asio_exit - wait for the
+     * threads that took it before it was cleared. If one is stalled, close
+     * the stream instead: jack_deactivate waits for the cycle. */
+    __atomic_store_n(&stream->status, NULL, __ATOMIC_SEQ_CST);
+    if (!release_status(stream)) {
+        WARN("Status block still in use, closing the JACK client instead of parking it\n");
+        return FALSE;
+    }
+    
+    pthread_mutex_lock(&park_mutex);
+    if (!reaper_running) {
+        if (pthread_create(&thread, NULL, reaper_thread, NULL)) {
+            pthread_mutex_unlock(&park_mutex);
+            WARN("Could not start the keep-alive reaper thread\n");
+            return FALSE;
+        }
+        pthread_detach(thread);
+        reaper_running = TRUE;
+    }
+    old = parked_stream;
+    parked_stream = stream;
+    clock_gettime(CLOCK_REALTIME, &park_deadline);
+    park_deadline.tv_sec += keep_alive / 1000;
+    park_deadline.tv_nsec += (long)(keep_alive % 1000) * 1000000;
+    if (park_deadline.tv_nsec >= 1000000000) {
+        park_deadline.tv_sec++;
+        park_deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_signal(&park_cond);
+    pthread_mutex_unlock(&park_mutex);
+    
+    if (old)
+        close_stream(old);
+    
+    TRACE("Parked JACK client %s for %d ms\n", stream->client_name, (int)keep_alive);
+    return TRUE;
+}
+
+/* Take the parked stream if it was opened with the same configuration.
+ * A parked stream with a different one is closed, freeing its client name. */
+static AsioStream *unpark_stream(const struct asio_config *config)
+{
+    AsioStream *stream;
+    
+    pthread_mutex_lock(&park_mutex);
+    stream = parked_stream;
+    parked_stream = NULL;
+    if (stream)
+        pthread_cond_signal(&park_cond);
+    pthread_mutex_unlock(&park_mutex);
+    
+    if (stream && memcmp(&stream->config, config, sizeof(*config))) {
+        TRACE("Configuration changed, closing parked JACK client\n");
+        close_stream(stream);
+        stream = NULL;
+    }
+    return stream;
+}
+
+/* Reuse a parked stream for a new Init */
+static void reattach_stream(AsioStream *stream, struct asio_status *status)
+{
+    struct asio_event event;
+    
+    /* Events and wakeups queued while parked belong to the old session */
+    while (pop_event(stream, &event));
+    stream->latched_events = 0;
+    while (!sem_trywait(&stream->callback_sem));
+    while (!sem_trywait(&stream->done_sem));
+    
+    /* The new host may not call OutputReady */
+    stream->output_ready = FALSE;
+    stream->ready_position = 0;
+    
+    stream->host_overruns = 0;
+    stream->jack_xruns = 0;
+    stream->events_dropped = 0;
+    stream->lock_failures = 0;
+    stream->sample_rate = pjack_get_sample_rate(stream->client);
+    stream->buffer_size = pjack_get_buffer_size(stream->client);
+    
+    __atomic_store_n(&stream->status, status, __ATOMIC_RELEASE);
+    publish_status(stream, 0, TRUE);
+    pthread_mutex_lock(&stream->connect_mutex);
+    publish_connections(stream);
+    pthread_mutex_unlock(&stream->connect_mutex);
+    stream->state = Initialized;
+}
+
+static NTSTATUS asio_init(void *args)
+{
+    struct asio_init_params *params = args;
+    AsioStream *stream;
+    jack_status_t status;
+    jack_options_t options;
+    int i;
+    
+    TRACE("asio_init called\n");
+    
+    if (!load_jack()) {
+        ERR("Could not load JACK library\n");
+        params->result = ASE_NotPresent;
+        return STATUS_SUCCESS;
+    }
+    
+    /* Keep-alive: reuse the client a previous Exit parked */
+    if ((stream = unpark_stream(&params->config))) {
+        reattach_stream(stream, (struct asio_status *)(UINT_PTR)params->status);
+        TRACE("Reattached parked JACK client %s\n", stream->client_name);
+        goto done;
+    }
+    
+    stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        params->result = ASE_NoMemory;
+        return STATUS_SUCCESS;
+    }
+    
+    /* Copy config */
+    stream->config = params->config;
+    stream->num_inputs = params->config.num_inputs > 0 ? params->config.num_inputs : 2;
+    stream->num_outputs = params->config.num_outputs > 0 ? params->config.num_outputs : 2;
+    stream->preferred_bufsize = params->config.preferred_bufsize > 0 ? params->config.preferred_bufsize : 1024;
+    stream->fixed_bufsize = params->config.fixed_bufsize;
+    stream->autoconnect = params->config.autoconnect;
+    stream->lazy_ports = params->config.lazy_ports;
+    stream->callback_spin = params->config.callback_spin;
+    stream->process_mode = params->config.process_mode;
+    stream->sync_deadline = params->config.sync_deadline > 0 ? params->config.sync_deadline : DEFAULT_SYNC_DEADLINE;
+    stream->status = (struct asio_status *)(UINT_PTR)params->status;
+    stream->callback_policy = params->config.callback_policy;
+    stream->callback_priority = params->config.callback_priority;
+    stream->pin_jack_thread = params->config.pin_jack_thread;
+    stream->denormal_protect = params->config.denormal_protect;
+    stream->huge_pages = params->config.huge_pages;
+    stream->page_align_buffers = params->config.page_align_buffers;
+    stream->lock_memory = params->config.lock_memory;
+    stream->safety_periods = params->config.safety_periods;
+    if (stream->safety_periods < 0) stream->safety_periods = 0;
+    if (stream->safety_periods > MAX_SAFETY_PERIODS) stream->safety_periods = MAX_SAFETY_PERIODS;
+    if (!asio_converter_init(&stream->conv, params->config.sample_type, asio_simd_detect())) {
+        WARN("Unsupported sample type %d, using Float32LSB\n", (int)params->config.sample_type);
+        asio_converter_init(&stream->conv, ASIOSTFloat32LSB, asio_simd_detect());
+    }
+    if (asio_converter_set_dither(&stream->conv, params->config.dither) != params->config.dither)
+        WARN("Dither mode %d not used for sample type %d\n", (int)params->config.dither, (int)stream->conv.type);
+    if (stream->safety_periods && stream->process_mode != WINEASIO_PROCESS_ASYNC) {
+        WARN("Safety periods only apply to the asynchronous process mode\n");
+        stream->safety_periods = 0;
+    }
+    
+    /* Callback CPU set, restricted to the CPUs this process may use */
+    if (params->config.cpu_set[0]) {
+        cpu_set_t allowed;
+        
+        memcpy(stream->cpu_list, params->config.cpu_set, sizeof(stream->cpu_list) - 1);
+        stream->num_cpus = parse_cpu_list(stream->cpu_list, &stream->cpu_set);
+        if (stream->num_cpus > 0 && !sched_getaffinity(0, sizeof(allowed), &allowed)) {
+            CPU_AND(&stream->cpu_set, &stream->cpu_set, &allowed);
+            stream->num_cpus = CPU_COUNT(&stream->cpu_set);
+        }
+        if (stream->num_cpus <= 0) {
+            WARN("Ignoring callback CPU set '%s': no usable CPUs\n", stream->cpu_list);
+            stream->num_cpus = 0;
+        }
+    }
+    
+    if (stream->process_mode == WINEASIO_PROCESS_DIRECT &&
+        (!pjack_set_process_thread || !pjack_cycle_wait || !pjack_cycle_signal)) {
+        WARN("JACK library lacks jack_cycle_wait, using synchronous mode instead of direct mode\n");
+        stream->process_mode = WINEASIO_PROCESS_SYNC;
+    }
+    if (stream->process_mode != WINEASIO_PROCESS_SYNC && stream->process_mode != WINEASIO_PROCESS_DIRECT)
+        stream->process_mode = WINEASIO_PROCESS_ASYNC;
+    if (stream->sync_deadline > 100) stream->sync_deadline = 100;
+    
+    if (stream->callback_spin < 0) stream->callback_spin = 0;
+    if (stream->callback_spin > MAX_CALLBACK_SPIN) stream->callback_spin = MAX_CALLBACK_SPIN;
+    if (stream->num_inputs > WINEASIO_MAX_CHANNELS) {
+        WARN("Limiting %d inputs to %d\n", stream->num_inputs, WINEASIO_MAX_CHANNELS);
+        stream->num_inputs = WINEASIO_MAX_CHANNELS;
+    }
+    if (stream->num_outputs > WINEASIO_MAX_CHANNELS) {
+        WARN("Limiting %d outputs to %d\n", stream->num_outputs, WINEASIO_MAX_CHANNELS);
+        stream->num_outputs = WINEASIO_MAX_CHANNELS;
+    }
+    if (!alloc_channels(stream)) {
+        ERR("Could not allocate %d + %d channels\n", stream->num_inputs, stream->num_outputs);
+        free_channels(stream);
+        free(stream);
+        params->result = ASE_NoMemory;
+        return STATUS_SUCCESS;
+    }
+    
+    /* Set client name */
+    if (params->config.client_name[0]) {
+        memcpy(stream->client_name, params->config.client_name, MAX_NAME_LENGTH - 1);
+        stream->client_name[MAX_NAME_LENGTH - 1] = '\0';
+    } else {
+        memcpy(stream->client_name, "WineASIO", 9);
+    }
+    
+    /* Open JACK client */
+    options = JackNoStartServer;  /* Don't start JACK if not running */
+    stream->client = pjack_client_open(stream->client_name, options, &status);
+    if (!stream->client) {
+        ERR("Could not open JACK client '%s' (status=0x%x)\n", stream->client_name, status);
+        free_channels(stream);
+        free(stream);
+        params->result = ASE_NotPresent;
+        return STATUS_SUCCESS;
+    }
+    
+    /* Get JACK info */
+    stream->sample_rate = pjack_get_sample_rate(stream->client);
+    stream->buffer_size = pjack_get_buffer_size(stream->client);
+    
+    /* Initialize event queue and wakeup semaphores */
+    init_events(stream);
+    sem_init(&stream->callback_sem, 0, 0);
+    sem_init(&stream->done_sem, 0, 0);
+    sem_init(&stream->attach_sem, 0, 0);
+    sem_init(&stream->handoff_sem, 0, 0);
+    pthread_mutex_init(&stream->connect_mutex, NULL);
+    pthread_cond_init(&stream->connect_cond, NULL);
+    if (params->config.routing[0]) {
+        char routing[sizeof(params->config.routing)];
         
+        memcpy(routing, params->config.routing, sizeof(routing) - 1);
+        routing[sizeof(routing) - 1] = '\0';
+        parse_routes(stream, routing);
+        TRACE("Routing map: %d rules\n", stream->num_routes);
+    }
+    
+    /* Valid rate in the status block before the first cycle */
+    publish_status(stream, 0, TRUE);
+    
+    /* Register ports - with lazy ports, asio_create_buffers registers the
+     * ports of the channels the host activates */
+    for (i = 0; i < stream->num_inputs; i++) {
+        snprintf(stream->inputs[i].name, MAX_NAME_LENGTH, "in_%d", i + 1);
+        if (!stream->lazy_ports)
+            register_port(stream, TRUE, i);
+        stream->inputs[i].active = FALSE;
+    }
+    
+    for (i = 0; i < stream->num_outputs; i++) {
+        snprintf(stream->outputs[i].name, MAX_NAME_LENGTH, "out_%d", i + 1);
+        if (!stream->lazy_ports)
+            register_port(stream, FALSE, i);
+        stream->outputs[i].active = FALSE;
+    }
+    
+    /* Set callbacks */
+    if (stream->process_mode == WINEASIO_PROCESS_DIRECT)
+        pjack_set_process_thread(stream->client, jack_process_thread, stream);
+    else
+        pjack_set_process_callback(stream->client, jack_process_callback, stream);
+    pjack_set_buffer_size_callback(stream->client, jack_buffer_size_callback, stream);
+    pjack_set_sample_rate_callback(stream->client, jack_sample_rate_callback, stream);
+    if (pjack_set_latency_callback)
+        pjack_set_latency_callback(stream->client, jack_latency_callback, stream);
+    if (pjack_set_xrun_callback)
+        pjack_set_xrun_callback(stream->client, jack_xrun_callback, stream);
+    if (((stream->pin_jack_thread && stream->num_cpus > 0) || stream->denormal_protect) &&
+        pjack_set_thread_init_callback)
+        pjack_set_thread_init_callback(stream->client, jack_thread_init, stream);
+    if (wants_connections(stream) && pjack_set_port_registration_callback && pjack_port_by_id &&
+        pjack_port_flags && pjack_port_type)
+        pjack_set_port_registration_callback(stream->client, jack_port_registration_callback, stream);
+    
+    /* Activate JACK client */
+    if (pjack_activate(stream->client)) {
+        ERR("Could not activate JACK client\n");
         pjack_client_close(stream->client);
+        sem_destroy(&stream->callback_sem);
+        sem_destroy(&stream->done_sem);
+        sem_destroy(&stream->attach_sem);
+        sem_destroy(&stream->handoff_sem);
+        pthread_cond_destroy(&stream->connect_cond);
+        pthread_mutex_destroy(&stream->connect_mutex);
+        free_routes(stream);
+        free_channels(stream);
+        free(stream);
+        params->result = ASE_HWMalfunction;
+        return STATUS_SUCCESS;
     }
     
-    /* Free port lists */
-    if (stream->jack_input_ports)
-        pjack_free(stream->jack_input_ports);
-    if (stream->jack_output_ports)
-        pjack_free(stream->jack_output_ports);
+    /* Auto-connect and apply the routing map in the background: the peer
+     * ports are enumerated and the ports connected after Init returns */
+    if (wants_connections(stream)) {
+        if (!pthread_create(&stream->connect_thread, NULL, connect_thread, stream))
+            stream->connect_thread_running = TRUE;
+        else
+            WARN("Could not start the connect worker, connecting synchronously\n");
+    }
+    request_connections(stream);
+    
+    stream->state = Initialized;
+    
+done:
+    /* Return info */
+    params->handle = (asio_handle)(UINT_PTR)stream;
+    params->input_channels = stream->num_inputs;
+    params->output_channels = stream->num_outputs;
+    params->sample_rate = stream->sample_rate;
+    params->process_mode = stream->process_mode;
+    params->sample_type = stream->conv.type;
+    params->result = ASE_OK;
+    
+    /* Single success message - useful to see WineASIO loaded */
+    fprintf(stderr, "[WineASIO] Initialized: %d in, %d out, %.0f Hz, %d samples, type %d (%s%s)%s%s%s%s\n",
+          stream->num_inputs, stream->num_outputs, stream->sample_rate, stream->buffer_size,
+          (int)stream->conv.type, asio_simd_name(stream->conv.level),
+          stream->conv.dither == WINEASIO_DITHER_SHAPED ? ", shaped dither" :
+          stream->conv.dither == WINEASIO_DITHER_TPDF ? ", TPDF dither" : "",
+          stream->process_mode == WINEASIO_PROCESS_SYNC ? ", synchronous" :
+          stream->process_mode == WINEASIO_PROCESS_DIRECT ? ", direct" : "",
+          stream->num_cpus > 0 ? ", callback CPUs " : "",
+          stream->num_cpus > 0 ? stream->cpu_list : "",
+          stream->num_cpus > 0 && stream->pin_jack_thread ? " (with JACK thread)" : "");
     
-    /* Free audio buffers */
-    for (i = 0; i < stream->num_inputs; i++)
-        free(stream->inputs[i].audio_buffer);
-    for (i = 0; i < stream->num_outputs; i++)
-        free(stream->outputs[i].audio_buffer);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS asio_exit(void *args)
+{
+    TRACE("%s called\n", __func__);
+    struct asio_exit_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
     
-    free(stream->callback_audio_buffer);
+    if (!stream) {
+        params->result = ASE_InvalidParameter;
+        return STATUS_SUCCESS;
+    }
     
-    pthread_mutex_destroy(&stream->callback_lock);
+    TRACE("Shutting down WineASIO\n");
     
-    free(stream);
+    if (!park_stream(stream))
+        close_stream(stream);
     params->result = ASE_OK;
     
     return STATUS_SUCCESS;
@@ -574,6 +2569,7 @@ static NTSTATUS asio_start(void *args)
     TRACE("%s called\n", __func__);
     struct asio_start_params *params = args;
     AsioStream *stream = handle_to_stream(params->handle);
+    struct asio_event event;
     int i;
     
     TRACE("asio_start called: stream=%p, state=%d\n", stream, stream ? stream->state : -1);
@@ -596,10 +2592,21 @@ static NTSTATUS asio_start(void *args)
                    sizeof(jack_default_audio_sample_t) * stream->buffer_size * 2);
     }
     
+    /* Events queued since Init (e.g. latency updates while connecting)
+     * describe state the host queries during setup anyway */
+    while (pop_event(stream, &event));
+    while (sem_trywait(&stream->callback_sem) == 0);
+    
     stream->buffer_index = 0;
     stream->sample_position = 0;
     stream->system_time = get_system_time();
-    stream->buffer_switch_pending = FALSE;
+    stream->release_position = -1;
+    stream->done_position = 0;
+    stream->ready_position = 0;
+    ring_reset(stream);
+    stream->host_overruns = 0;
+    stream->jack_xruns = 0;
+    publish_status(stream, 0, TRUE);
     
     stream->state = Running;
     params->result = ASE_OK;
@@ -623,7 +2630,10 @@ static NTSTATUS asio_stop(void *args)
     stream->state = Prepared;
     params->result = ASE_OK;
     
-    TRACE("WineASIO stopped\n");
+    /* Wake a callback thread blocked in asio_wait_callback so it can exit */
+    signal_callback(stream);
+    
+    TRACE("WineASIO stopped: %u host overruns, %u JACK xruns\n", stream->host_overruns, stream->jack_xruns);
     
     return STATUS_SUCCESS;
 }
@@ -646,12 +2656,24 @@ static NTSTATUS asio_get_channels(void *args)
     return STATUS_SUCCESS;
 }
 
+/* Output samples queued between the host's buffers and JACK in async mode:
+ * one period, none once the host uses OutputReady, or the safety periods */
+static LONG internal_output_samples(const AsioStream *stream)
+{
+    if (stream->process_mode != WINEASIO_PROCESS_ASYNC)
+        return 0;
+    if (stream->ring_periods)
+        return stream->safety_periods * stream->ring_frames;
+    return stream->output_ready ? 0 : stream->buffer_size;
+}
+
 static NTSTATUS asio_get_latencies(void *args)
 {
     TRACE("%s called\n", __func__);
     struct asio_get_latencies_params *params = args;
     AsioStream *stream = handle_to_stream(params->handle);
     jack_latency_range_t range;
+    jack_port_t *port;
     
     if (!stream) {
         params->result = ASE_InvalidParameter;
@@ -660,18 +2682,23 @@ static NTSTATUS asio_get_latencies(void *args)
     
     /* Get latency from JACK if available */
     stream->input_latency = stream->buffer_size;
-    stream->output_latency = stream->buffer_size * 2;
+    stream->output_latency = stream->buffer_size;
     
-    if (pjack_port_get_latency_range && stream->num_inputs > 0 && stream->inputs[0].port) {
-        pjack_port_get_latency_range(stream->inputs[0].port, JackCaptureLatency, &range);
+    if (pjack_port_get_latency_range && (port = first_port(stream->inputs, stream->num_inputs))) {
+        pjack_port_get_latency_range(port, JackCaptureLatency, &range);
         stream->input_latency = range.max > 0 ? range.max : stream->buffer_size;
     }
     
-    if (pjack_port_get_latency_range && stream->num_outputs > 0 && stream->outputs[0].port) {
-        pjack_port_get_latency_range(stream->outputs[0].port, JackPlaybackLatency, &range);
-        stream->output_latency = range.max > 0 ? range.max : stream->buffer_size * 2;
+    if (pjack_port_get_latency_range && (port = first_port(stream->outputs, stream->num_outputs))) {
+        pjack_port_get_latency_range(port, JackPlaybackLatency, &range);
+        stream->output_latency = range.max > 0 ? range.max : stream->buffer_size;
     }
     
+    /* In async mode the host writes ahead of the JACK cycle; sync and
+     * direct mode deliver the host's output in the same cycle */
+    if (stream->process_mode == WINEASIO_PROCESS_ASYNC)
+        stream->output_latency += internal_output_samples(stream);
+    
     params->input_latency = stream->input_latency;
     params->output_latency = stream->output_latency;
     params->result = ASE_OK;
@@ -786,7 +2813,7 @@ static NTSTATUS asio_get_channel_info(void *args)
         }
         params->info.is_active = stream->inputs[channel].active;
         params->info.channel_group = 0;
-        params->info.sample_type = ASIOSTFloat32LSB;
+        params->info.sample_type = stream->conv.type;
         memcpy(params->info.name, stream->inputs[channel].name, 31);
         params->info.name[31] = '\0';
     } else {
@@ -796,7 +2823,7 @@ static NTSTATUS asio_get_channel_info(void *args)
         }
         params->info.is_active = stream->outputs[channel].active;
         params->info.channel_group = 0;
-        params->info.sample_type = ASIOSTFloat32LSB;
+        params->info.sample_type = stream->conv.type;
         memcpy(params->info.name, stream->outputs[channel].name, 31);
         params->info.name[31] = '\0';
     }
@@ -806,11 +2833,55 @@ static NTSTATUS asio_get_channel_info(void *args)
     return STATUS_SUCCESS;
 }
 
+static NTSTATUS asio_describe_stream(void *args)
+{
+    TRACE("%s called\n", __func__);
+    struct asio_describe_stream_params *params = args;
+    struct asio_channel_info *infos = (struct asio_channel_info *)(UINT_PTR)params->channel_infos;
+    AsioStream *stream = handle_to_stream(params->handle);
+    struct asio_get_latencies_params latencies = { .handle = params->handle };
+    struct asio_get_buffer_size_params sizes = { .handle = params->handle };
+    struct asio_get_channel_info_params info = { .handle = params->handle };
+    int i;
+    
+    if (!stream || (params->num_channel_infos && !infos) ||
+        (params->num_channel_infos && params->num_channel_infos < stream->num_inputs + stream->num_outputs)) {
+        params->result = ASE_InvalidParameter;
+        return STATUS_SUCCESS;
+    }
+    
+    /* Read first - a change while the rest is gathered invalidates the result */
+    params->describe_gen = __atomic_load_n(&stream->describe_gen, __ATOMIC_ACQUIRE);
+    
+    asio_get_latencies(&latencies);
+    asio_get_buffer_size(&sizes);
+    params->num_inputs = stream->num_inputs;
+    params->num_outputs = stream->num_outputs;
+    params->input_latency = latencies.input_latency;
+    params->output_latency = latencies.output_latency;
+    params->min_size = sizes.min_size;
+    params->max_size = sizes.max_size;
+    params->preferred_size = sizes.preferred_size;
+    params->granularity = sizes.granularity;
+    params->sample_rate = stream->sample_rate;
+    
+    for (i = 0; infos && i < stream->num_inputs + stream->num_outputs; i++) {
+        info.info.is_input = i < stream->num_inputs;
+        info.info.channel = info.info.is_input ? i : i - stream->num_inputs;
+        asio_get_channel_info(&info);
+        infos[i] = info.info;
+    }
+    
+    params->result = ASE_OK;
+    
+    return STATUS_SUCCESS;
+}
+
 static NTSTATUS asio_create_buffers(void *args)
 {
     struct asio_create_buffers_params *params = args;
     AsioStream *stream = handle_to_stream(params->handle);
-    struct asio_buffer_info *infos = params->buffer_infos;
+    struct asio_buffer_info *infos = (struct asio_buffer_info *)(UINT_PTR)params->buffer_infos;
     int i, j;
     
     TRACE("asio_create_buffers: num_channels=%d, buffer_size=%d\n", 
@@ -823,10 +2894,25 @@ static NTSTATUS asio_create_buffers(void *args)
     }
     
     if (!infos || params->num_channels <= 0) {
+        params->unix_alloc = FALSE;
         params->result = ASE_InvalidParameter;
         return STATUS_SUCCESS;
     }
     
+    /* The previous buffers may be freed below - lock_memory locks the new set */
+    unlock_memory(stream);
+    
+    /* Unix-owned arena - on failure the PE side allocates one and calls again */
+    stream->buffer_frames = asio_buffer_capacity(params->buffer_size, params->buffer_frames);
+    if (params->unix_alloc &&
+        !alloc_buffer_arena(stream, infos, params->num_channels, stream->buffer_frames, params->low_address)) {
+        params->unix_alloc = FALSE;
+        params->result = ASE_NoMemory;
+        return STATUS_SUCCESS;
+    }
+    if (!params->unix_alloc)
+        free_buffer_arena(stream);
+    
     /* Set buffer size if different and not fixed */
     if (params->buffer_size != stream->buffer_size && !stream->fixed_bufsize) {
         if (pjack_set_buffer_size)
@@ -842,10 +2928,21 @@ static NTSTATUS asio_create_buffers(void *args)
      * Buffers allocated here with calloc() would have 64-bit addresses that
      * cannot be accessed by 32-bit Windows code.
      *
-     * The PE side has already set buffer_ptr[0] and buffer_ptr[1] to valid
-     * 32-bit addresses. We just need to store these pointers and mark channels active.
+     * buffer_ptr[0] and buffer_ptr[1] point into an arena with PE-visible
+     * (32-bit for WoW64) addresses, allocated by alloc_buffer_arena above or
+     * by the PE side. We just need to store these pointers and mark channels active.
      */
     
+    /* Whether the host calls OutputReady is learned again for these buffers */
+    stream->output_ready = FALSE;
+    stream->ready_position = 0;
+    
+    /* Channels of earlier buffers point into a freed arena */
+    for (j = 0; j < stream->num_inputs; j++)
+        stream->inputs[j].active = FALSE;
+    for (j = 0; j < stream->num_outputs; j++)
+        stream->outputs[j].active = FALSE;
+    
     /* Process each channel - use PE-allocated buffer pointers */
     for (i = 0; i < params->num_channels; i++) {
         int ch = infos[i].channel_num;
@@ -863,8 +2960,8 @@ static NTSTATUS asio_create_buffers(void *args)
             }
             
             /* Store PE-side buffer pointers for JACK callback use */
-            stream->inputs[ch].pe_buffer[0] = (jack_default_audio_sample_t *)(UINT_PTR)infos[i].buffer_ptr[0];
-            stream->inputs[ch].pe_buffer[1] = (jack_default_audio_sample_t *)(UINT_PTR)infos[i].buffer_ptr[1];
+            stream->inputs[ch].pe_buffer[0] = (void *)(UINT_PTR)infos[i].buffer_ptr[0];
+            stream->inputs[ch].pe_buffer[1] = (void *)(UINT_PTR)infos[i].buffer_ptr[1];
             stream->inputs[ch].active = TRUE;
         } else {
             if (ch < 0 || ch >= stream->num_outputs) {
@@ -879,8 +2976,8 @@ static NTSTATUS asio_create_buffers(void *args)
             }
             
             /* Store PE-side buffer pointers for JACK callback use */
-            stream->outputs[ch].pe_buffer[0] = (jack_default_audio_sample_t *)(UINT_PTR)infos[i].buffer_ptr[0];
-            stream->outputs[ch].pe_buffer[1] = (jack_default_audio_sample_t *)(UINT_PTR)infos[i].buffer_ptr[1];
+            stream->outputs[ch].pe_buffer[0] = (void *)(UINT_PTR)infos[i].buffer_ptr[0];
+            stream->outputs[ch].pe_buffer[1] = (void *)(UINT_PTR)infos[i].buffer_ptr[1];
             stream->outputs[ch].active = TRUE;
         }
     }
@@ -893,11 +2990,53 @@ static NTSTATUS asio_create_buffers(void *args)
     for (j = 0; j < stream->num_outputs; j++)
         if (stream->outputs[j].active) stream->active_outputs = TRUE;
     
+    /* Safety rings for the active channels - capacity one period above the
+     * safety periods, so the host can queue its output before JACK takes one */
+    free_rings(stream);
+    if (stream->safety_periods > 0) {
+        size_t ring_size;
+        BOOL failed = FALSE;
+        
+        /* A ring period is copied whole into a host buffer, so the JACK
+         * period must fit one - JACK may have refused or not yet applied
+         * the size, or a fixed buffer size may exceed the host's */
+        if (stream->buffer_size > stream->buffer_frames) {
+            ERR("JACK period %d does not fit the %d sample host buffers\n",
+                stream->buffer_size, stream->buffer_frames);
+            params->result = ASE_InvalidMode;
+            return STATUS_SUCCESS;
+        }
+        
+        ring_size = sizeof(jack_default_audio_sample_t) * (stream->safety_periods + 1) * stream->buffer_size;
+        
+        for (j = 0; j < stream->num_inputs; j++)
+            if (stream->inputs[j].active && !(stream->inputs[j].ring = calloc(1, ring_size)))
+                failed = TRUE;
+        for (j = 0; j < stream->num_outputs; j++)
+            if (stream->outputs[j].active && !(stream->outputs[j].ring = calloc(1, ring_size)))
+                failed = TRUE;
+        
+        if (failed) {
+            ERR("Could not allocate safety rings\n");
+            free_rings(stream);
+            params->result = ASE_NoMemory;
+            return STATUS_SUCCESS;
+        }
+        stream->ring_periods = stream->safety_periods + 1;
+        stream->ring_frames = stream->buffer_size;
+        ring_reset(stream);
+    }
+    
+    update_lazy_ports(stream);
+    build_active_channels(stream);
+    lock_memory(stream, infos, params->num_channels,
+                (void *)(UINT_PTR)params->pe_state, params->pe_state_size);
+    
     stream->state = Prepared;
     params->result = ASE_OK;
     
-    TRACE("Buffers created: %d channels, %d samples\n",
-          params->num_channels, stream->buffer_size);
+    TRACE("Buffers created: %d channels, %d samples, room for %d\n",
+          params->num_channels, stream->buffer_size, stream->buffer_frames);
     
     return STATUS_SUCCESS;
 }
@@ -906,30 +3045,13 @@ static NTSTATUS asio_dispose_buffers(void *args)
 {
     struct asio_dispose_buffers_params *params = args;
     AsioStream *stream = handle_to_stream(params->handle);
-    int i;
     
     if (!stream) {
         params->result = ASE_InvalidParameter;
         return STATUS_SUCCESS;
     }
     
-    if (stream->state == Running) {
-        stream->state = Prepared;
-    }
-    
-    /* Free buffers and mark inactive */
-    for (i = 0; i < stream->num_inputs; i++) {
-        free(stream->inputs[i].audio_buffer);
-        stream->inputs[i].audio_buffer = NULL;
-        stream->inputs[i].active = FALSE;
-    }
-    for (i = 0; i < stream->num_outputs; i++) {
-        free(stream->outputs[i].audio_buffer);
-        stream->outputs[i].audio_buffer = NULL;
-        stream->outputs[i].active = FALSE;
-    }
-    
-    stream->state = Initialized;
+    dispose_buffers(stream);
     params->result = ASE_OK;
     
     TRACE("Buffers disposed\n");
@@ -939,10 +3061,50 @@ static NTSTATUS asio_dispose_buffers(void *args)
 
 static NTSTATUS asio_output_ready(void *args)
 {
+    /* Note: No TRACE here - called once per buffer switch */
     struct asio_output_ready_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    
+    if (!stream) {
+        params->result = ASE_InvalidParameter;
+        return STATUS_SUCCESS;
+    }
+    
+    params->result = ASE_OK;
+    
+    /* Support probe, or a call outside a buffer switch. With safety periods
+     * the output is queued when bufferSwitch returns anyway. */
+    if (stream->state != Running || !params->sample_position || stream->ring_periods)
+        return STATUS_SUCCESS;
+    
+    if (!stream->output_ready) {
+        TRACE("Host uses OutputReady, output latency reduced by one period\n");
+        stream->output_ready = TRUE;
+        if (stream->process_mode == WINEASIO_PROCESS_ASYNC)
+            push_event(stream, ASIO_EVENT_LATENCY, -1, 0.0);
+    }
     
-    /* We don't need this optimization since JACK handles timing */
-    params->result = ASE_NotPresent;
+    switch (stream->process_mode) {
+    case WINEASIO_PROCESS_SYNC:
+        /* Release the JACK cycle without waiting for bufferSwitch to return */
+        __atomic_store_n(&stream->release_position, params->sample_position, __ATOMIC_RELEASE);
+        sem_post(&stream->done_sem);
+        break;
+        
+    case WINEASIO_PROCESS_DIRECT:
+        /* Let the JACK graph continue now; only the thread running the
+         * cycle may signal it */
+        if (stream->cycle_open && stream->open_index == params->buffer_index &&
+            pthread_equal(stream->cycle_thread, pthread_self()))
+            finish_cycle(stream);
+        break;
+        
+    default:
+        /* Picked up by the next jack_process_callback */
+        stream->ready_index = params->buffer_index;
+        __atomic_store_n(&stream->ready_position, params->sample_position, __ATOMIC_RELEASE);
+        break;
+    }
     
     return STATUS_SUCCESS;
 }
@@ -965,9 +3127,75 @@ static NTSTATUS asio_get_sample_position(void *args)
     return STATUS_SUCCESS;
 }
 
+/* Append latched events after the queued ones, which are older. Types
+ * that do not fit this batch stay latched for the next one. */
+static void take_latched_events(AsioStream *stream, struct asio_get_callback_params *params)
+{
+    UINT32 mask = __atomic_exchange_n(&stream->latched_events, 0, __ATOMIC_ACQUIRE);
+    UINT32 type;
+    
+    for (type = 0; mask && params->num_events < ASIO_MAX_EVENTS; type++) {
+        struct asio_event *event;
+        
+        if (!(mask & (1u << type)))
+            continue;
+        mask &= ~(1u << type);
+        
+        event = &params->events[params->num_events++];
+        event->type = type;
+        event->seq = stream->event_tail;
+        event->buffer_index = -1;
+        event->sample_position = stream->sample_position;
+        event->system_time = stream->system_time;
+        __atomic_load(&stream->latched_values[type], &event->value, __ATOMIC_RELAXED);
+    }
+    if (mask)
+        __atomic_or_fetch(&stream->latched_events, mask, __ATOMIC_RELAXED);
+}
+
+/* Move queued events into the callback params, oldest first.
+ * With safety periods the host must process every buffer switch, so a
+ * batch ends after the first one, whose input period is fetched here. */
+static void fill_callback_params(AsioStream *stream, struct asio_get_callback_params *params)
+{
+    struct asio_event *event;
+    
+    params->num_events = 0;
+    while (params->num_events < ASIO_MAX_EVENTS) {
+        event = &params->events[params->num_events];
+        if (!pop_event(stream, event)) {
+            take_latched_events(stream, params);
+            break;
+        }
+        params->num_events++;
+        
+        if (stream->ring_periods && event->type == ASIO_EVENT_BUFFER_SWITCH) {
+            ring_take_input(stream, event->buffer_index);
+            break;
+        }
+    }
+}
+
 static NTSTATUS asio_get_callback(void *args)
 {
-    /* Note: No TRACE here - this is called ~1000x/sec and would cause xruns */
+    /* Note: No TRACE here - this is called once per buffer switch */
+    struct asio_get_callback_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    
+    if (!stream) {
+        params->result = ASE_InvalidParameter;
+        return STATUS_SUCCESS;
+    }
+    
+    fill_callback_params(stream, params);
+    params->result = ASE_OK;
+    
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS asio_wait_callback(void *args)
+{
+    /* Note: No TRACE here - called once per buffer switch */
     struct asio_get_callback_params *params = args;
     AsioStream *stream = handle_to_stream(params->handle);
     
@@ -976,44 +3204,247 @@ static NTSTATUS asio_get_callback(void *args)
         return STATUS_SUCCESS;
     }
     
-    pthread_mutex_lock(&stream->callback_lock);
+    /* Events left over from a batch cut short need no wait - their
+     * wakeups were already consumed. On timeout fall through anyway,
+     * asio_get_callback then reports no events. */
+    if (!event_pending(stream))
+        wait_for_callback(stream, params->timeout_ms > 0 ? params->timeout_ms : 0);
+    
+    return asio_get_callback(args);
+}
+
+static NTSTATUS asio_callback_done(void *args)
+{
+    /* Note: No TRACE here - called once per buffer switch */
+    struct asio_callback_done_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    
+    if (!stream) {
+        params->result = ASE_InvalidParameter;
+        return STATUS_SUCCESS;
+    }
+    
+    if (stream->ring_periods)
+        ring_put_output(stream, params->buffer_index);
+    
+    /* Marks the switch finished for the overrun check in jack_process_callback */
+    __atomic_store_n(&stream->done_position, params->sample_position, __ATOMIC_RELEASE);
     
-    params->buffer_switch_ready = stream->buffer_switch_pending;
-    params->buffer_index = stream->pending_buffer_index;
-    params->direct_process = TRUE;
+    /* Release the RT thread waiting in wait_for_host */
+    if (stream->process_mode == WINEASIO_PROCESS_SYNC) {
+        __atomic_store_n(&stream->release_position, params->sample_position, __ATOMIC_RELEASE);
+        sem_post(&stream->done_sem);
+    }
+    
+    params->result = ASE_OK;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS asio_cycle_attach(void *args)
+{
+    struct asio_cycle_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    struct timespec ts;
+    LONG owner = CYCLE_JACK;
+    int ret;
     
-    params->time_info.speed = 1.0;
-    params->time_info.system_time = stream->system_time;
-    params->time_info.sample_position = stream->sample_position;
-    params->time_info.sample_rate = stream->sample_rate;
-    params->time_info.flags = 0x7;  /* Valid flags */
+    if (!stream || stream->process_mode != WINEASIO_PROCESS_DIRECT) {
+        params->result = ASE_InvalidMode;
+        return STATUS_SUCCESS;
+    }
     
-    params->sample_rate_changed = stream->sample_rate_changed;
-    params->new_sample_rate = stream->new_sample_rate;
-    params->reset_request = stream->reset_request;
-    params->resync_request = FALSE;
-    params->latency_changed = stream->latency_changed;
+    /* The JACK thread hands over right after its next jack_cycle_signal */
+    if (!__atomic_compare_exchange_n(&stream->cycle_owner, &owner, CYCLE_REQUESTED, FALSE,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && owner == CYCLE_PE) {
+        params->result = ASE_OK;
+        return STATUS_SUCCESS;
+    }
     
-    /* Clear pending flags and log only on actual buffer switch */
-    if (stream->buffer_switch_pending) {
-        TRACE("Buffer switch ready, index=%d\n", params->buffer_index);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += params->timeout_ms / 1000;
+    ts.tv_nsec += (long)(params->timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    while ((ret = sem_timedwait(&stream->attach_sem, &ts)) != 0 && errno == EINTR);
+    
+    if (ret != 0) {
+        /* Withdraw the request, unless the JACK thread granted it after
+         * the timeout - then its sem_post follows right away */
+        owner = CYCLE_REQUESTED;
+        if (__atomic_compare_exchange_n(&stream->cycle_owner, &owner, CYCLE_JACK, FALSE,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            ERR("Timed out waiting for the JACK process thread\n");
+            params->result = ASE_HWMalfunction;
+            return STATUS_SUCCESS;
+        }
+        while (sem_wait(&stream->attach_sem) != 0 && errno == EINTR);
     }
-    stream->buffer_switch_pending = FALSE;
-    stream->sample_rate_changed = FALSE;
-    stream->reset_request = FALSE;
-    stream->latency_changed = FALSE;
     
-    pthread_mutex_unlock(&stream->callback_lock);
+    /* The JACK cycle now runs on this thread */
+    set_denormal_mode(stream);
     
+    TRACE("PE callback thread now runs the JACK cycle\n");
     params->result = ASE_OK;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS asio_cycle_detach(void *args)
+{
+    struct asio_cycle_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    
+    if (!stream || !pe_owns_cycle(stream)) {
+        params->result = ASE_InvalidMode;
+        return STATUS_SUCCESS;
+    }
+    
+    if (stream->cycle_open)
+        finish_cycle(stream);
     
+    __atomic_store_n(&stream->cycle_owner, CYCLE_JACK, __ATOMIC_RELEASE);
+    sem_post(&stream->handoff_sem);
+    
+    TRACE("JACK process thread runs the cycle again\n");
+    params->result = ASE_OK;
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS asio_callback_done(void *args)
+static NTSTATUS asio_process_cycle(void *args)
 {
-    struct asio_callback_done_params *params = args;
-    /* Currently unused - the callback is processed synchronously */
+    /* Note: No TRACE here - runs once per JACK cycle in the PE thread */
+    struct asio_get_callback_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    jack_nframes_t nframes;
+    LONG buffer_index;
+    
+    if (!stream || !pe_owns_cycle(stream)) {
+        params->result = ASE_InvalidMode;
+        return STATUS_SUCCESS;
+    }
+    
+    /* Send what the host produced for the previous cycle */
+    if (stream->cycle_open)
+        finish_cycle(stream);
+    
+    nframes = pjack_cycle_wait(stream->client);
+    
+    buffer_index = stream->buffer_index;
+    stream->open_index = buffer_index;
+    stream->open_nframes = nframes;
+    stream->cycle_open = TRUE;
+    stream->cycle_thread = pthread_self();
+    
+    if (stream->state == Running) {
+        enter_port_section(stream);
+        copy_inputs(stream, buffer_index, nframes);
+        leave_port_section(stream);
+        
+        stream->sample_position += nframes;
+        stream->system_time = get_system_time();
+        
+        push_event(stream, ASIO_EVENT_BUFFER_SWITCH, buffer_index, stream->sample_rate);
+        
+        stream->buffer_index = buffer_index ? 0 : 1;
+    }
+    publish_status(stream, buffer_index, FALSE);
+    
+    fill_callback_params(stream, params);
+    params->result = ASE_OK;
+    return STATUS_SUCCESS;
+}
+
+/* Pin the calling thread - the PE callback thread - to "Callback CPU set" */
+static NTSTATUS asio_set_thread_affinity(void *args)
+{
+    struct asio_thread_affinity_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    int err;
+    
+    params->num_cpus = 0;
+    
+    if (!stream) {
+        params->result = ASE_InvalidParameter;
+        return STATUS_SUCCESS;
+    }
+    
+    if (stream->num_cpus <= 0) {
+        params->result = ASE_OK;
+        return STATUS_SUCCESS;
+    }
+    
+    err = pthread_setaffinity_np(pthread_self(), sizeof(stream->cpu_set), &stream->cpu_set);
+    if (err) {
+        WARN("Could not pin callback thread to CPUs %s: %s\n", stream->cpu_list, strerror(err));
+        params->result = ASE_NotPresent;
+        return STATUS_SUCCESS;
+    }
+    
+    TRACE("Callback thread pinned to CPUs %s\n", stream->cpu_list);
+    params->num_cpus = stream->num_cpus;
+    params->result = ASE_OK;
+    return STATUS_SUCCESS;
+}
+
+/* Promote the calling thread - the PE callback thread - to realtime
+ * scheduling. The automatic priority is one below JACK's process thread so
+ * JACK always preempts the host; in direct mode the thread runs the JACK
+ * cycle itself and gets JACK's own priority. */
+static NTSTATUS asio_set_thread_priority(void *args)
+{
+    struct asio_thread_priority_params *params = args;
+    AsioStream *stream = handle_to_stream(params->handle);
+    struct sched_param sp;
+    struct rlimit limit;
+    int policy, prio, err;
+    
+    params->priority = 0;
+    
+    if (!stream) {
+        params->result = ASE_InvalidParameter;
+        return STATUS_SUCCESS;
+    }
+    
+    if (stream->callback_policy == WINEASIO_SCHED_NONE) {
+        params->result = ASE_OK;
+        return STATUS_SUCCESS;
+    }
+    
+    policy = stream->callback_policy == WINEASIO_SCHED_RR ? SCHED_RR : SCHED_FIFO;
+    prio = stream->callback_priority;
+    if (prio <= 0) {
+        int jack_prio = pjack_client_real_time_priority ? pjack_client_real_time_priority(stream->client) : -1;
+        
+        if (jack_prio <= 0) {
+            WARN("JACK is not running realtime, callback thread priority unchanged\n");
+            params->result = ASE_NotPresent;
+            return STATUS_SUCCESS;
+        }
+        prio = stream->process_mode == WINEASIO_PROCESS_DIRECT ? jack_prio : jack_prio - 1;
+    }
+    if (prio < sched_get_priority_min(policy)) prio = sched_get_priority_min(policy);
+    if (prio > sched_get_priority_max(policy)) prio = sched_get_priority_max(policy);
+    
+    sp.sched_priority = prio;
+    err = pthread_setschedparam(pthread_self(), policy, &sp);
+    
+    /* Retry at the highest priority RLIMIT_RTPRIO allows */
+    if (err == EPERM && !getrlimit(RLIMIT_RTPRIO, &limit) &&
+        limit.rlim_cur > 0 && limit.rlim_cur < (rlim_t)prio) {
+        WARN("Priority %d exceeds RLIMIT_RTPRIO, using %d\n", prio, (int)limit.rlim_cur);
+        prio = sp.sched_priority = (int)limit.rlim_cur;
+        err = pthread_setschedparam(pthread_self(), policy, &sp);
+    }
+    
+    if (err) {
+        WARN("Could not set realtime priority %d: %s\n", prio, strerror(err));
+        params->result = ASE_NotPresent;
+        return STATUS_SUCCESS;
+    }
+    
+    TRACE("Callback thread running %s at priority %d\n", policy == SCHED_RR ? "SCHED_RR" : "SCHED_FIFO", prio);
+    params->priority = prio;
     params->result = ASE_OK;
     return STATUS_SUCCESS;
 }
@@ -1074,6 +3505,30 @@ static NTSTATUS asio_future(void *args)
         params->result = ASE_SUCCESS;
         break;
         
+    case kAsioGetInternalBufferSamples:
+        if (!params->opt) {
+            params->result = ASE_InvalidParameter;
+            break;
+        }
+        {
+            struct asio_internal_buffer_info *info = (struct asio_internal_buffer_info *)(UINT_PTR)params->opt;
+            info->input_samples = 0;
+            info->output_samples = internal_output_samples(stream);
+        }
+        params->result = ASE_SUCCESS;
+        break;
+        
+    case kAsioCanReportOverload:
+        /* Host overruns and JACK xruns are sent as kAsioOverload */
+        params->result = ASE_SUCCESS;
+        break;
+        
+    case kWineAsioConnectionsReady:
+        /* opt: optional LONG, milliseconds to wait */
+        params->result = wait_connections(stream, params->opt ? *(LONG *)(UINT_PTR)params->opt : 0)
+                         ? ASE_SUCCESS : ASE_InvalidMode;
+        break;
+        
     case kAsioCanInputMonitor:
     case kAsioCanTransport:
     case kAsioCanInputGain:
@@ -1115,6 +3570,13 @@ const unixlib_entry_t __wine_unix_call_funcs[] =
     asio_callback_done,
     asio_control_panel,
     asio_future,
+    asio_wait_callback,
+    asio_cycle_attach,
+    asio_cycle_detach,
+    asio_process_cycle,
+    asio_set_thread_priority,
+    asio_set_thread_affinity,
+    asio_describe_stream,
 };
 
 C_ASSERT(ARRAYSIZE(__wine_unix_call_funcs) == unix_funcs_count);
@@ -1143,6 +3605,13 @@ const unixlib_entry_t __wine_unix_call_wow64_funcs[] =
     asio_callback_done,
     asio_control_panel,
     asio_future,
+    asio_wait_callback,
+    asio_cycle_attach,
+    asio_cycle_detach,
+    asio_process_cycle,
+    asio_set_thread_priority,
+    asio_set_thread_affinity,
+    asio_describe_stream,
 };
 
 C_ASSERT(ARRAYSIZE(__wine_unix_call_wow64_funcs) == unix_funcs_count);
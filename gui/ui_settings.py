@@ -46,7 +46,7 @@ class Ui_WineASIOSettings(object):
         self.label_ports_in.setObjectName("label_ports_in")
         self.layout_ports_in.addWidget(self.label_ports_in)
         self.sb_ports_in = QSpinBox(self.group_ports)
-        self.sb_ports_in.setMaximum(128)
+        self.sb_ports_in.setMaximum(1024)
         self.sb_ports_in.setSingleStep(2)
         self.sb_ports_in.setObjectName("sb_ports_in")
         self.layout_ports_in.addWidget(self.sb_ports_in)
@@ -59,7 +59,7 @@ class Ui_WineASIOSettings(object):
         self.layout_ports_out.addWidget(self.label_ports_out)
         self.sb_ports_out = QSpinBox(self.group_ports)
         self.sb_ports_out.setMinimum(2)
-        self.sb_ports_out.setMaximum(128)
+        self.sb_ports_out.setMaximum(1024)
         self.sb_ports_out.setSingleStep(2)
         self.sb_ports_out.setObjectName("sb_ports_out")
         self.layout_ports_out.addWidget(self.sb_ports_out)
@@ -0,0 +1,125 @@
+/* Buffer Layout Benchmark
+ *
+ * Purpose: Compare the old CreateBuffers layout (one heap block, laid out
+ * [ch0 half0][ch0 half1][ch1 half0]..., inputs and outputs mixed) with the
+ * buffer arena (grouped by buffer half, then direction, 64-byte aligned).
+ *
+ * Each simulated cycle does what a buffer switch does to one half: the
+ * JACK side writes all inputs, the "host" reads them and writes all
+ * outputs, and the JACK side reads the outputs back. Between cycles a
+ * working set larger than the cache is touched, like other host and
+ * plugin work would, so the buffers are cold at the start of each cycle.
+ *
+ * Compile (native):
+ *   gcc -O2 -o bench_buffer_layout bench_buffer_layout.c
+ *
+ * Run:
+ *   ./bench_buffer_layout [channels per direction] [buffer size]
+ *   (defaults: 128 channels per direction, 128 samples)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CYCLES      2000
+#define EVICT_BYTES (16 * 1024 * 1024)
+
+static float *in_buf[2][1024], *out_buf[2][1024];
+
+/* Old layout: channel pairs of halves, inputs and outputs interleaved in
+ * host order (alternating), 16-byte heap alignment */
+static char *layout_legacy(int channels, size_t bytes)
+{
+    char *block = malloc(2 * 2 * channels * bytes + 64);
+    char *base = block + 16;
+    int i;
+
+    for (i = 0; i < 2 * channels; i++) {
+        float **half0 = i % 2 ? &out_buf[0][i / 2] : &in_buf[0][i / 2];
+        float **half1 = i % 2 ? &out_buf[1][i / 2] : &in_buf[1][i / 2];
+        *half0 = (float *)(base + (i * 2) * bytes);
+        *half1 = (float *)(base + (i * 2 + 1) * bytes);
+    }
+    return block;
+}
+
+/* Arena: [half 0: inputs][half 0: outputs][half 1: inputs][half 1: outputs],
+ * stride padded off page multiples as in asio_buffer_stride */
+static char *layout_arena(int channels, size_t bytes)
+{
+    size_t stride = (bytes + 63) & ~(size_t)63;
+    if (!(stride & 4095))
+        stride += 64;
+    char *base = aligned_alloc(4096, (2 * 2 * channels * stride + 4095) & ~(size_t)4095);
+    int h, i;
+
+    for (h = 0; h < 2; h++) {
+        for (i = 0; i < channels; i++) {
+            in_buf[h][i] = (float *)(base + (h * 2 * channels + i) * stride);
+            out_buf[h][i] = (float *)(base + (h * 2 * channels + channels + i) * stride);
+        }
+    }
+    return base;
+}
+
+static double run(int channels, int frames, const float *port, float *sink, char *evict)
+{
+    struct timespec t0, t1;
+    double total = 0.0;
+    int c, i, j;
+
+    for (c = 0; c < CYCLES; c++) {
+        int h = c & 1;
+
+        /* Other work between buffer switches */
+        for (j = 0; j < EVICT_BYTES; j += 64)
+            evict[j]++;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < channels; i++)
+            memcpy(in_buf[h][i], port, sizeof(float) * frames);
+        for (i = 0; i < channels; i++)
+            for (j = 0; j < frames; j++)
+                out_buf[h][i][j] = in_buf[h][i][j] * 0.5f;
+        for (i = 0; i < channels; i++)
+            memcpy(sink, out_buf[h][i], sizeof(float) * frames);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        total += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    }
+    return total / CYCLES;
+}
+
+int main(int argc, char **argv)
+{
+    int channels = argc > 1 ? atoi(argv[1]) : 128;
+    int frames = argc > 2 ? atoi(argv[2]) : 128;
+    size_t bytes = sizeof(float) * frames;
+    float *port = calloc(frames, sizeof(float));
+    float *sink = calloc(frames, sizeof(float));
+    char *evict = calloc(1, EVICT_BYTES);
+    char *block;
+    double legacy, arena;
+
+    if (channels <= 0 || channels > 1024 || frames <= 0) {
+        fprintf(stderr, "usage: %s [channels 1-1024] [buffer size]\n", argv[0]);
+        return 1;
+    }
+
+    block = layout_legacy(channels, bytes);
+    run(channels, frames, port, sink, evict);   /* Warm up */
+    legacy = run(channels, frames, port, sink, evict);
+    free(block);
+
+    block = layout_arena(channels, bytes);
+    run(channels, frames, port, sink, evict);
+    arena = run(channels, frames, port, sink, evict);
+    free(block);
+
+    printf("%d in + %d out channels, %d samples per buffer\n", channels, channels, frames);
+    printf("  legacy layout: %8.0f ns per buffer switch\n", legacy);
+    printf("  buffer arena:  %8.0f ns per buffer switch (%.0f%%)\n", arena, 100.0 * arena / legacy);
+    return 0;
+}
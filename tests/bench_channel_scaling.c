@@ -0,0 +1,214 @@
+/* Channel Scaling Benchmark
+ *
+ * Purpose: Measure how the cost of one JACK cycle grows with the number of
+ * configured channels, for the old scan over every IOChannel slot and for
+ * the dense active-channel tables the cycle walks now.
+ *
+ * Each simulated cycle copies the active inputs to the host buffers and the
+ * active outputs back to JACK, and silences the inactive outputs, like
+ * copy_inputs/copy_outputs with Float32 buffers. The channel structures
+ * mirror IOChannel and ActiveChannel in asio_unix.c. Between cycles a
+ * working set larger than the cache is touched, like other host and plugin
+ * work would, so every cycle starts cold. Times are medians over the
+ * cycles, with the variants interleaved (see run). The last column is the part of
+ * the dense cycle spent silencing registered but inactive output ports,
+ * which still grows with the configured count.
+ *
+ * Compile (native):
+ *   gcc -O2 -o bench_channel_scaling bench_channel_scaling.c
+ *
+ * Run:
+ *   ./bench_channel_scaling [active channels per direction]
+ *   (default: 8; configured counts from 2 to 512 per direction)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAMES      128
+#define CYCLES      1001    /* Odd, for the median */
+#define WARMUP      100
+#define EVICT_BYTES (16 * 1024 * 1024)
+#define MAX_COUNT   512
+
+/* As in asio_unix.c: configuration per slot, hot copy per active channel */
+typedef struct {
+    float *port;
+    char name[64];
+    int active;
+    float *audio_buffer;
+    void *pe_buffer[2];
+    float *ring;
+} IOChannel;
+
+typedef struct {
+    float *port;
+    void *pe_buffer[2];
+    float *ring;
+    unsigned int dither[9];
+} ActiveChannel;
+
+static IOChannel inputs[MAX_COUNT], outputs[MAX_COUNT];
+static ActiveChannel active_in[MAX_COUNT], active_out[MAX_COUNT];
+static float *idle_out[MAX_COUNT];
+static int num_active_in, num_active_out, num_idle_out;
+
+/* Stands in for jack_port_get_buffer */
+static __attribute__((noinline)) float *port_get_buffer(float *port)
+{
+    return port;
+}
+
+static void cycle_scan(int count, int half)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (inputs[i].active && inputs[i].port) {
+            float *jack_buf = port_get_buffer(inputs[i].port);
+            if (jack_buf && inputs[i].pe_buffer[half])
+                memcpy(inputs[i].pe_buffer[half], jack_buf, sizeof(float) * FRAMES);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (outputs[i].port) {
+            float *jack_buf = port_get_buffer(outputs[i].port);
+            if (outputs[i].active && outputs[i].pe_buffer[half])
+                memcpy(jack_buf, outputs[i].pe_buffer[half], sizeof(float) * FRAMES);
+            else
+                memset(jack_buf, 0, sizeof(float) * FRAMES);
+        }
+    }
+}
+
+static void cycle_silence(int count, int half)
+{
+    int i;
+
+    (void)count;
+    (void)half;
+    for (i = 0; i < num_idle_out; i++)
+        memset(port_get_buffer(idle_out[i]), 0, sizeof(float) * FRAMES);
+}
+
+static void cycle_dense(int count, int half)
+{
+    int i;
+
+    for (i = 0; i < num_active_in; i++)
+        memcpy(active_in[i].pe_buffer[half], port_get_buffer(active_in[i].port), sizeof(float) * FRAMES);
+    for (i = 0; i < num_active_out; i++)
+        memcpy(port_get_buffer(active_out[i].port), active_out[i].pe_buffer[half], sizeof(float) * FRAMES);
+    cycle_silence(count, half);
+}
+
+/* Channels spread over the configured range, like a host enabling a few
+ * of a large interface's channels */
+static void setup(int count, int active, float *ports, float *buffers)
+{
+    int i, step = count / active;
+
+    memset(inputs, 0, sizeof(inputs));
+    memset(outputs, 0, sizeof(outputs));
+    num_active_in = num_active_out = num_idle_out = 0;
+
+    for (i = 0; i < count; i++) {
+        inputs[i].port = ports + (size_t)i * FRAMES;
+        outputs[i].port = ports + (size_t)(MAX_COUNT + i) * FRAMES;
+        if (i % step || i / step >= active) {
+            idle_out[num_idle_out++] = outputs[i].port;
+            continue;
+        }
+        inputs[i].active = outputs[i].active = 1;
+        inputs[i].pe_buffer[0] = buffers + (size_t)(4 * i) * FRAMES;
+        inputs[i].pe_buffer[1] = buffers + (size_t)(4 * i + 1) * FRAMES;
+        outputs[i].pe_buffer[0] = buffers + (size_t)(4 * i + 2) * FRAMES;
+        outputs[i].pe_buffer[1] = buffers + (size_t)(4 * i + 3) * FRAMES;
+
+        active_in[num_active_in].port = inputs[i].port;
+        memcpy(active_in[num_active_in++].pe_buffer, inputs[i].pe_buffer, sizeof(inputs[i].pe_buffer));
+        active_out[num_active_out].port = outputs[i].port;
+        memcpy(active_out[num_active_out++].pe_buffer, outputs[i].pe_buffer, sizeof(outputs[i].pe_buffer));
+    }
+}
+
+static double samples[3][CYCLES];
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double time_cycle(void (*cycle)(int, int), int count, int half, char *evict)
+{
+    struct timespec t0, t1;
+    int j;
+
+    for (j = 0; j < EVICT_BYTES; j += 64)
+        evict[j]++;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    cycle(count, half);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+}
+
+/* Median cycle time of each variant. The variants take turns within every
+ * round, in rotating order, so frequency changes and other load hit all of
+ * them alike; the median drops cycles hit by an interrupt. */
+static void run(void (*const cycles[3])(int, int), int count, char *evict, double *median)
+{
+    int c, k;
+
+    for (c = 0; c < WARMUP; c++)
+        for (k = 0; k < 3; k++)
+            time_cycle(cycles[k], count, c & 1, evict);
+
+    for (c = 0; c < CYCLES; c++)
+        for (k = 0; k < 3; k++) {
+            int v = (c + k) % 3;
+            samples[v][c] = time_cycle(cycles[v], count, c & 1, evict);
+        }
+
+    for (k = 0; k < 3; k++) {
+        qsort(samples[k], CYCLES, sizeof(double), compare_double);
+        median[k] = samples[k][CYCLES / 2];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const int counts[] = { 2, 8, 16, 32, 64, 128, 192, 256, 384, 512 };
+    static void (*const cycles[3])(int, int) = { cycle_scan, cycle_dense, cycle_silence };
+    int active = argc > 1 ? atoi(argv[1]) : 8;
+    float *ports = calloc((size_t)2 * MAX_COUNT * FRAMES, sizeof(float));
+    float *buffers = calloc((size_t)4 * MAX_COUNT * FRAMES, sizeof(float));
+    char *evict = calloc(1, EVICT_BYTES);
+    unsigned int i;
+
+    if (active <= 0 || active > MAX_COUNT) {
+        fprintf(stderr, "usage: %s [active channels 1-%d]\n", argv[0], MAX_COUNT);
+        return 1;
+    }
+
+    printf("%d active channels per direction, %d samples per cycle\n", active, FRAMES);
+    printf("configured   slot scan   dense tables         idle outputs\n");
+
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        int count = counts[i];
+        int n = active < count ? active : count;
+        double median[3];
+
+        setup(count, n, ports, buffers);
+        run(cycles, count, evict, median);
+
+        printf("%10d %8.0f ns %10.0f ns (%3.0f%%) %9.0f ns\n",
+               count, median[0], median[1], 100.0 * median[1] / median[0], median[2]);
+    }
+    return 0;
+}
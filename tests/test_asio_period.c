@@ -0,0 +1,306 @@
+/* ASIO Period Mismatch Test
+ *
+ * Purpose: Check that CreateBuffers refuses safety rings whose JACK period
+ * does not fit the host buffers, instead of letting the callback thread
+ * copy a whole period past the end of them.
+ *
+ * The test enables "Safety periods" and "Fixed buffersize" for the run, so
+ * the JACK period stays at the size GetBufferSize reports, then:
+ * 1. Calls CreateBuffers() with half that size - must fail with ASE_InvalidMode
+ * 2. Calls CreateBuffers() with the JACK period - must succeed
+ * 3. Runs Start() for a second and checks buffer switches arrive
+ * The previous registry values are restored afterwards.
+ *
+ * Compile:
+ *   i686-w64-mingw32-gcc -o test_asio_period.exe test_asio_period.c -lole32 -luuid -ladvapi32
+ *
+ * Run (JACK must be running):
+ *   WINEDEBUG=-all wine test_asio_period.exe
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <ole2.h>
+
+/* WineASIO CLSID: {48D0C522-BFCC-45CC-8B84-17F25F33E6E8} */
+static const GUID CLSID_WineASIO = {
+    0x48d0c522, 0xbfcc, 0x45cc,
+    {0x8b, 0x84, 0x17, 0xf2, 0x5f, 0x33, 0xe6, 0xe8}
+};
+
+/* IID_IUnknown */
+static const GUID IID_IUnknown_Local = {
+    0x00000000, 0x0000, 0x0000,
+    {0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}
+};
+
+#define ASE_OK          0
+#define ASE_InvalidMode (-997)
+
+#define WINEASIO_KEY    "Software\\Wine\\WineASIO"
+
+typedef struct IWineASIO IWineASIO;
+
+typedef struct {
+    long isInputType;
+    long channelNumber;
+    void *audioBufferStart;
+    void *audioBufferEnd;
+} BufferInformation;
+
+typedef struct {
+    void (*swapBuffers)(long, long);
+    void (*sampleRateChanged)(double);
+    long (*sendNotification)(long, long, void*, double*);
+    void* (*swapBuffersWithTimeInfo)(void*, long, long);
+} Callbacks;
+
+/* Call a method with no extra args: long method(this) */
+static __inline__ LONG call_thiscall_0(void *func, IWineASIO *pThis)
+{
+    LONG result;
+    __asm__ __volatile__ (
+        "movl %1, %%ecx\n\t"
+        "call *%2\n\t"
+        : "=a" (result)
+        : "r" (pThis), "r" (func)
+        : "ecx", "edx", "memory"
+    );
+    return result;
+}
+
+/* Call Init: long Init(this, void *sysRef) */
+static __inline__ LONG call_thiscall_init(void *func, IWineASIO *pThis, void *sysRef)
+{
+    LONG result;
+    __asm__ __volatile__ (
+        "pushl %2\n\t"
+        "movl %1, %%ecx\n\t"
+        "call *%3\n\t"
+        : "=a" (result)
+        : "r" (pThis), "r" (sysRef), "r" (func)
+        : "ecx", "edx", "memory"
+    );
+    return result;
+}
+
+/* Call GetBufferSize: long GetBufferSize(this, long *min, long *max, long *pref, long *gran) */
+static __inline__ LONG call_thiscall_4_ptr(void *func, IWineASIO *pThis, void *a1, void *a2, void *a3, void *a4)
+{
+    LONG result;
+    __asm__ __volatile__ (
+        "pushl %5\n\t"
+        "pushl %4\n\t"
+        "pushl %3\n\t"
+        "pushl %2\n\t"
+        "movl %1, %%ecx\n\t"
+        "call *%6\n\t"
+        : "=a" (result)
+        : "r" (pThis), "g" (a1), "g" (a2), "g" (a3), "g" (a4), "r" (func)
+        : "ecx", "edx", "memory"
+    );
+    return result;
+}
+
+/* Call CreateBuffers: long CreateBuffers(this, BufferInformation *info, long num, long size, Callbacks *cb) */
+static __inline__ LONG call_thiscall_create_buffers(void *func, IWineASIO *pThis,
+                                                      BufferInformation *info, LONG num, LONG size, Callbacks *cb)
+{
+    LONG result;
+    __asm__ __volatile__ (
+        "pushl %5\n\t"
+        "pushl %4\n\t"
+        "pushl %3\n\t"
+        "pushl %2\n\t"
+        "movl %1, %%ecx\n\t"
+        "call *%6\n\t"
+        : "=a" (result)
+        : "r" (pThis), "g" (info), "g" (num), "g" (size), "g" (cb), "r" (func)
+        : "ecx", "edx", "memory"
+    );
+    return result;
+}
+
+/* ASIO vtable structure */
+typedef struct IWineASIOVtbl {
+    HRESULT (STDMETHODCALLTYPE *QueryInterface)(IWineASIO *This, REFIID riid, void **ppvObject);
+    ULONG (STDMETHODCALLTYPE *AddRef)(IWineASIO *This);
+    ULONG (STDMETHODCALLTYPE *Release)(IWineASIO *This);
+
+    void *Init;
+    void *GetDriverName;
+    void *GetDriverVersion;
+    void *GetErrorMessage;
+    void *Start;
+    void *Stop;
+    void *GetChannels;
+    void *GetLatencies;
+    void *GetBufferSize;
+    void *CanSampleRate;
+    void *GetSampleRate;
+    void *SetSampleRate;
+    void *GetClockSources;
+    void *SetClockSource;
+    void *GetSamplePosition;
+    void *GetChannelInfo;
+    void *CreateBuffers;
+    void *DisposeBuffers;
+    void *ControlPanel;
+    void *Future;
+    void *OutputReady;
+} IWineASIOVtbl;
+
+struct IWineASIO {
+    const IWineASIOVtbl *lpVtbl;
+};
+
+static volatile LONG g_bufferSwitchCount = 0;
+
+static void swapBuffers(long index, long processNow)
+{
+    InterlockedIncrement(&g_bufferSwitchCount);
+}
+
+static void sampleRateChanged(double sampleRate)
+{
+}
+
+static long sendNotification(long selector, long value, void *message, double *opt)
+{
+    return 0;
+}
+
+static void* swapBuffersWithTimeInfo(void *timeInfo, long index, long processNow)
+{
+    InterlockedIncrement(&g_bufferSwitchCount);
+    return NULL;
+}
+
+/* Registry values changed for the run, restored by restore_config */
+static const char *const g_values[] = { "Safety periods", "Fixed buffersize" };
+static DWORD g_saved[2];
+static BOOL g_had_value[2];
+
+static void set_config(void)
+{
+    HKEY hkey;
+    DWORD i, value, size, type;
+
+    if (RegCreateKeyExA(HKEY_CURRENT_USER, WINEASIO_KEY, 0, NULL, 0, KEY_ALL_ACCESS, NULL, &hkey, NULL))
+        return;
+    for (i = 0; i < 2; i++) {
+        size = sizeof(DWORD);
+        g_had_value[i] = !RegQueryValueExA(hkey, g_values[i], NULL, &type, (BYTE *)&g_saved[i], &size) &&
+                         type == REG_DWORD;
+        value = i == 0 ? 2 : 1;
+        RegSetValueExA(hkey, g_values[i], 0, REG_DWORD, (BYTE *)&value, sizeof(DWORD));
+    }
+    RegCloseKey(hkey);
+}
+
+static void restore_config(void)
+{
+    HKEY hkey;
+    DWORD i;
+
+    if (RegOpenKeyExA(HKEY_CURRENT_USER, WINEASIO_KEY, 0, KEY_ALL_ACCESS, &hkey))
+        return;
+    for (i = 0; i < 2; i++) {
+        if (g_had_value[i])
+            RegSetValueExA(hkey, g_values[i], 0, REG_DWORD, (BYTE *)&g_saved[i], sizeof(DWORD));
+        else
+            RegDeleteValueA(hkey, g_values[i]);
+    }
+    RegCloseKey(hkey);
+}
+
+static void setup_buffers(BufferInformation *info)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        info[i].isInputType = i < 2;
+        info[i].channelNumber = i % 2;
+        info[i].audioBufferStart = NULL;
+        info[i].audioBufferEnd = NULL;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    IWineASIO *pAsio = NULL;
+    BufferInformation bufferInfo[4];
+    Callbacks callbacks = { swapBuffers, sampleRateChanged, sendNotification, swapBuffersWithTimeInfo };
+    LONG minSize = 0, maxSize = 0, prefSize = 0, granularity = 0;
+    LONG result;
+    int failures = 0;
+
+    printf("\nWineASIO Period Mismatch Test\n\n");
+
+    set_config();
+    CoInitialize(NULL);
+
+    if (FAILED(CoCreateInstance(&CLSID_WineASIO, NULL, CLSCTX_INPROC_SERVER,
+                                &IID_IUnknown_Local, (void**)&pAsio)) || !pAsio) {
+        printf("ERROR: CoCreateInstance failed\n");
+        failures++;
+        goto done;
+    }
+    if (!call_thiscall_init(pAsio->lpVtbl->Init, pAsio, NULL)) {
+        printf("ERROR: Init failed - is JACK running?\n");
+        failures++;
+        goto release;
+    }
+
+    call_thiscall_4_ptr(pAsio->lpVtbl->GetBufferSize, pAsio, &minSize, &maxSize, &prefSize, &granularity);
+    printf("JACK period: %ld samples\n", prefSize);
+
+    /* 1. Host buffers smaller than the JACK period */
+    setup_buffers(bufferInfo);
+    result = call_thiscall_create_buffers(pAsio->lpVtbl->CreateBuffers, pAsio,
+                                          bufferInfo, 4, prefSize / 2, &callbacks);
+    if (result == ASE_InvalidMode) {
+        printf("OK: CreateBuffers(%ld) refused with ASE_InvalidMode\n", prefSize / 2);
+    } else {
+        printf("FAIL: CreateBuffers(%ld) returned %ld, expected ASE_InvalidMode\n", prefSize / 2, result);
+        failures++;
+        if (result == ASE_OK)
+            call_thiscall_0(pAsio->lpVtbl->DisposeBuffers, pAsio);
+    }
+
+    /* 2. Host buffers matching the JACK period */
+    setup_buffers(bufferInfo);
+    result = call_thiscall_create_buffers(pAsio->lpVtbl->CreateBuffers, pAsio,
+                                          bufferInfo, 4, prefSize, &callbacks);
+    if (result != ASE_OK) {
+        printf("FAIL: CreateBuffers(%ld) returned %ld\n", prefSize, result);
+        failures++;
+        goto release;
+    }
+    printf("OK: CreateBuffers(%ld) succeeded\n", prefSize);
+
+    /* 3. The rings run */
+    if (call_thiscall_0(pAsio->lpVtbl->Start, pAsio) == ASE_OK) {
+        Sleep(1000);
+        call_thiscall_0(pAsio->lpVtbl->Stop, pAsio);
+        if (g_bufferSwitchCount > 0) {
+            printf("OK: %ld buffer switches\n", g_bufferSwitchCount);
+        } else {
+            printf("FAIL: no buffer switches\n");
+            failures++;
+        }
+    } else {
+        printf("FAIL: Start failed\n");
+        failures++;
+    }
+    call_thiscall_0(pAsio->lpVtbl->DisposeBuffers, pAsio);
+
+release:
+    pAsio->lpVtbl->Release(pAsio);
+done:
+    CoUninitialize();
+    restore_config();
+
+    printf("\n%s\n\n", failures ? "Test FAILED" : "Test passed");
+    return failures ? 1 : 0;
+}
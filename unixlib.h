@@ -56,8 +56,9 @@ static inline NTSTATUS __wine_unix_call(unixlib_handle_t handle, unsigned int co
 
 #endif /* WINE_UNIX_LIB */
 
-/* Maximum number of channels */
-#define WINEASIO_MAX_CHANNELS 128
+/* Sanity limit for the configured channel counts; the channel arrays are
+ * allocated for the configured count */
+#define WINEASIO_MAX_CHANNELS 1024
 
 /* Sample types matching ASIO SDK */
 typedef enum {
@@ -81,6 +82,62 @@ typedef enum {
     ASIOSTInt32LSB24 = 27,
 } ASIOSampleType;
 
+/* Bytes per sample of the types the driver converts to, 0 if unsupported */
+static inline LONG asio_sample_size(ASIOSampleType type)
+{
+    switch (type) {
+    case ASIOSTInt16LSB:
+    case ASIOSTInt16MSB:
+        return 2;
+    case ASIOSTInt24LSB:
+    case ASIOSTInt24MSB:
+        return 3;
+    case ASIOSTInt32LSB:
+    case ASIOSTInt32MSB:
+    case ASIOSTFloat32LSB:
+    case ASIOSTFloat32MSB:
+    case ASIOSTInt32LSB16:
+    case ASIOSTInt32LSB18:
+    case ASIOSTInt32LSB20:
+    case ASIOSTInt32LSB24:
+    case ASIOSTInt32MSB16:
+    case ASIOSTInt32MSB18:
+    case ASIOSTInt32MSB20:
+    case ASIOSTInt32MSB24:
+        return 4;
+    case ASIOSTFloat64LSB:
+    case ASIOSTFloat64MSB:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/* Buffer arena layout, used by whichever side allocates it:
+ *   [half 0: inputs][half 0: outputs][half 1: inputs][half 1: outputs]
+ * Channel buffers start on a cache line, or on a page if page_align. A
+ * cache-line stride is never a multiple of a page, which would map every
+ * channel's buffer to the same L1 sets. */
+#define WINEASIO_BUFFER_ALIGN       64
+#define WINEASIO_BUFFER_PAGE_ALIGN  4096
+
+static inline UINT64 asio_buffer_stride(LONG sample_size, LONG buffer_size, BOOL page_align)
+{
+    UINT64 align = page_align ? WINEASIO_BUFFER_PAGE_ALIGN : WINEASIO_BUFFER_ALIGN;
+    UINT64 stride = ((UINT64)sample_size * buffer_size + align - 1) & ~(align - 1);
+    
+    if (!page_align && !(stride & (WINEASIO_BUFFER_PAGE_ALIGN - 1)))
+        stride += WINEASIO_BUFFER_ALIGN;
+    return stride;
+}
+
+/* Samples each buffer holds: with max_bufsize set, room for JACK periods
+ * up to it, so a period change within it needs no new buffers */
+static inline LONG asio_buffer_capacity(LONG buffer_size, LONG max_bufsize)
+{
+    return max_bufsize > buffer_size ? max_bufsize : buffer_size;
+}
+
 /* Stream handle - opaque pointer to Unix-side stream */
 typedef UINT64 asio_handle;
 
@@ -91,6 +148,23 @@ struct asio_buffer_info {
     UINT64 buffer_ptr[2];  /* Double-buffering pointers */
 };
 
+/* Point the buffer_ptr of each channel into an arena at base of
+ * 2 * num_channels * stride bytes */
+static inline void asio_buffer_layout(struct asio_buffer_info *infos, LONG num_channels, UINT64 base, UINT64 stride)
+{
+    LONG i, in_slot = 0, out_slot = 0;
+    
+    for (i = 0; i < num_channels; i++)
+        if (infos[i].is_input)
+            out_slot++;
+    
+    for (i = 0; i < num_channels; i++) {
+        LONG slot = infos[i].is_input ? in_slot++ : out_slot++;
+        infos[i].buffer_ptr[0] = base + slot * stride;
+        infos[i].buffer_ptr[1] = base + (num_channels + slot) * stride;
+    }
+}
+
 /* Channel info */
 struct asio_channel_info {
     LONG channel;
@@ -101,14 +175,31 @@ struct asio_channel_info {
     char name[32];
 };
 
-/* Time info from JACK */
-struct asio_time_info {
-    double speed;
-    INT64 system_time;
-    INT64 sample_position;
-    double sample_rate;
-    UINT32 flags;
-};
+/* Callback thread scheduling (registry "Callback policy") */
+#define WINEASIO_SCHED_NONE     0   /* Leave the thread under SCHED_OTHER */
+#define WINEASIO_SCHED_FIFO     1
+#define WINEASIO_SCHED_RR       2
+
+/* Process modes (registry "Process mode") */
+#define WINEASIO_PROCESS_ASYNC  0   /* Host fills the buffer played one period later */
+#define WINEASIO_PROCESS_SYNC   1   /* JACK cycle waits for the host's bufferSwitch */
+#define WINEASIO_PROCESS_DIRECT 2   /* PE callback thread runs the JACK cycle itself */
+
+/* Dither for integer sample types (registry "Dither") */
+#define WINEASIO_DITHER_NONE    0
+#define WINEASIO_DITHER_TPDF    1   /* Triangular noise, +-1 LSB */
+#define WINEASIO_DITHER_SHAPED  2   /* TPDF with first-order noise shaping */
+
+/* Huge pages for the Unix-side buffer arena (registry "Huge pages") */
+#define WINEASIO_HUGE_PAGES_OFF         0
+#define WINEASIO_HUGE_PAGES_TRANSPARENT 1   /* madvise(MADV_HUGEPAGE) */
+#define WINEASIO_HUGE_PAGES_EXPLICIT    2   /* MAP_HUGETLB, falls back to transparent */
+
+/* MXCSR bits for denormal protection (registry "Denormal protection") */
+#define WINEASIO_MXCSR_DE       0x0002  /* Sticky: denormal operand seen */
+#define WINEASIO_MXCSR_UE       0x0010  /* Sticky: underflow, a result was denormal or flushed */
+#define WINEASIO_MXCSR_DAZ      0x0040  /* Denormal inputs are treated as zero */
+#define WINEASIO_MXCSR_FTZ      0x8000  /* Denormal results are flushed to zero */
 
 /* Configuration read from registry (passed to Unix side) */
 struct asio_config {
@@ -117,7 +208,26 @@ struct asio_config {
     LONG preferred_bufsize;
     BOOL fixed_bufsize;
     BOOL autoconnect;
+    LONG callback_spin;     /* Microseconds to spin before blocking for a callback */
+    LONG process_mode;      /* WINEASIO_PROCESS_* */
+    LONG sync_deadline;     /* Percent of the period to wait for the host in sync mode */
+    LONG callback_policy;   /* WINEASIO_SCHED_* for the PE callback thread */
+    LONG callback_priority; /* Realtime priority, 0 = derive from JACK */
+    BOOL pin_jack_thread;   /* Also pin JACK's process thread to cpu_set */
+    LONG safety_periods;    /* Extra output periods buffered in async mode */
+    LONG sample_type;       /* ASIOSampleType presented to the host */
+    LONG dither;            /* WINEASIO_DITHER_* */
+    BOOL denormal_protect;  /* Set FTZ/DAZ on the JACK and callback threads */
+    BOOL page_align_buffers; /* Start every channel buffer on its own page */
+    BOOL unix_buffers;      /* Unix side allocates the buffer arena */
+    LONG huge_pages;        /* WINEASIO_HUGE_PAGES_* for a Unix-side arena */
+    BOOL lock_memory;       /* mlock and prefault the memory the JACK cycle touches */
+    BOOL lazy_ports;        /* Register JACK ports for activated channels only */
+    LONG keep_alive;        /* Milliseconds to keep the JACK client after Exit, 0 = close */
+    LONG max_bufsize;       /* JACK period the buffers are sized for, 0 = the host's buffer size (default) */
     char client_name[64];
+    char cpu_set[64];       /* CPU list for the callback thread, e.g. "2,3" or "4-7" */
+    char routing[1024];     /* Routing map, e.g. "in_1-2=system:capture_*;out_*=~^Mixer:" */
 };
 
 /*
@@ -131,6 +241,9 @@ struct asio_init_params {
     LONG input_channels;
     LONG output_channels;
     double sample_rate;
+    LONG process_mode;      /* Effective mode - DIRECT falls back to SYNC if unsupported */
+    UINT64 status;          /* PE-allocated struct asio_status, 32-bit addressable */
+    LONG sample_type;       /* Effective type - unsupported types fall back to Float32LSB */
 };
 
 struct asio_exit_params {
@@ -195,12 +308,36 @@ struct asio_get_channel_info_params {
     HRESULT result;
 };
 
+/* Everything the host queries during setup, in one call. The PE side
+ * caches it until describe_gen in the status block changes. */
+struct asio_describe_stream_params {
+    asio_handle handle;
+    HRESULT result;
+    UINT32 describe_gen;
+    LONG num_inputs;
+    LONG num_outputs;
+    LONG input_latency;
+    LONG output_latency;
+    LONG min_size;
+    LONG max_size;
+    LONG preferred_size;
+    LONG granularity;
+    double sample_rate;
+    LONG num_channel_infos;     /* In: capacity of channel_infos */
+    UINT64 channel_infos;       /* struct asio_channel_info array: inputs, then outputs */
+};
+
 struct asio_create_buffers_params {
     asio_handle handle;
     LONG num_channels;
     LONG buffer_size;
-    struct asio_buffer_info *buffer_infos;  /* Array of buffer_info */
+    UINT64 buffer_infos;    /* struct asio_buffer_info array; UINT64 keeps the layout equal for WoW64 */
     HRESULT result;
+    BOOL unix_alloc;        /* In: Unix side allocates and fills buffer_ptr; out: FALSE if it could not */
+    BOOL low_address;       /* Buffers must be 32-bit addressable (WoW64 host) */
+    UINT64 pe_state;        /* PE driver object (host_time etc.), locked with the buffers */
+    UINT64 pe_state_size;
+    LONG buffer_frames;     /* Samples each buffer holds, see asio_buffer_capacity */
 };
 
 struct asio_dispose_buffers_params {
@@ -210,6 +347,8 @@ struct asio_dispose_buffers_params {
 
 struct asio_output_ready_params {
     asio_handle handle;
+    LONG buffer_index;      /* Buffer half of the switch the host finished */
+    INT64 sample_position;  /* Its sample position, 0 for the support probe */
     HRESULT result;
 };
 
@@ -220,25 +359,84 @@ struct asio_get_sample_position_params {
     INT64 system_time;
 };
 
-/* Callback notification - PE side polls for this */
-struct asio_get_callback_params {
+struct asio_thread_priority_params {
+    asio_handle handle;
+    HRESULT result;
+    LONG priority;          /* Applied realtime priority, 0 if unchanged */
+};
+
+struct asio_thread_affinity_params {
     asio_handle handle;
     HRESULT result;
-    BOOL buffer_switch_ready;
+    LONG num_cpus;          /* CPUs the thread was pinned to, 0 if unchanged */
+};
+
+/* Stream status shared with the PE side.
+ * Written by the Unix side once per JACK cycle and read without a unix call
+ * by any host thread. Seqlock: seq is odd while an update is in progress, so
+ * readers retry until they see the same even value before and after copying.
+ * Exactly one cache line, allocated on its own page by the PE side. */
+struct asio_status {
+    UINT32 seq;
+    LONG buffer_index;          /* Buffer half of the last buffer switch */
+    INT64 sample_position;
+    INT64 system_time;
+    double sample_rate;
+    UINT32 host_overruns;       /* Buffer switches the host did not finish in time */
+    UINT32 jack_xruns;          /* Xruns reported by JACK */
+    float load;                 /* JACK DSP load in percent */
+    UINT32 lock_failures;       /* Regions that could not be mlock'ed (RLIMIT_MEMLOCK) */
+    UINT32 describe_gen;        /* Bumped on reset, rate and latency changes, see asio_describe_stream */
+    UINT32 connections_ready;   /* Autoconnect plan applied, see kWineAsioConnectionsReady */
+    BYTE pad[8];
+};
+
+/* Events queued by the JACK threads for the PE callback thread */
+enum asio_event_type {
+    ASIO_EVENT_BUFFER_SWITCH,   /* buffer_index, sample_position, system_time, value = sample rate */
+    ASIO_EVENT_RESET,           /* value = new buffer size */
+    ASIO_EVENT_SAMPLE_RATE,     /* value = new sample rate */
+    ASIO_EVENT_LATENCY,
+    ASIO_EVENT_XRUN,            /* value = JACK delayed usecs */
+    ASIO_EVENT_HOST_OVERRUN,    /* Host missed a buffer switch deadline */
+    ASIO_EVENT_BUFFER_SIZE,     /* value = new buffer size, fits the buffers: kAsioBufferSizeChange */
+};
+
+struct asio_event {
+    UINT32 type;            /* enum asio_event_type */
+    UINT32 seq;             /* Queue sequence number, increases by one per queued event */
     LONG buffer_index;
-    BOOL direct_process;
-    struct asio_time_info time_info;
-    BOOL sample_rate_changed;
-    double new_sample_rate;
-    BOOL reset_request;
-    BOOL resync_request;
-    BOOL latency_changed;
+    INT64 sample_position;
+    INT64 system_time;
+    double value;
+};
+
+/* Maximum events returned by one callback unix call */
+#define ASIO_MAX_EVENTS 16
+
+/* Callback notification - returned by asio_get_callback (non-blocking)
+ * and asio_wait_callback (blocks up to timeout_ms for the next event).
+ * Events are in the order they were queued. */
+struct asio_get_callback_params {
+    asio_handle handle;
+    LONG timeout_ms;
+    HRESULT result;
+    LONG num_events;
+    struct asio_event events[ASIO_MAX_EVENTS];
 };
 
 /* Acknowledge that callback was processed */
 struct asio_callback_done_params {
     asio_handle handle;
     LONG buffer_index;
+    INT64 sample_position;  /* Identifies the completed buffer switch */
+    HRESULT result;
+};
+
+/* Hand the JACK process cycle to / back from the calling PE thread (direct mode) */
+struct asio_cycle_params {
+    asio_handle handle;
+    LONG timeout_ms;
     HRESULT result;
 };
 
@@ -277,6 +475,13 @@ enum unix_funcs {
     unix_asio_callback_done,
     unix_asio_control_panel,
     unix_asio_future,
+    unix_asio_wait_callback,
+    unix_asio_cycle_attach,
+    unix_asio_cycle_detach,
+    unix_asio_process_cycle,
+    unix_asio_set_thread_priority,
+    unix_asio_set_thread_affinity,
+    unix_asio_describe_stream,
     unix_funcs_count
 };
 
@@ -291,6 +496,23 @@ enum unix_funcs {
 #define ASE_NoClock         (-995)
 #define ASE_NoMemory        (-994)
 
+/* kAsioGetInternalBufferSamples result (ASIOInternalBufferInfo) */
+struct asio_internal_buffer_info {
+    LONG input_samples;
+    LONG output_samples;
+};
+
+/* Host message selectors (asioMessage) */
+#define kAsioSelectorSupported      1
+#define kAsioEngineVersion          2
+#define kAsioResetRequest           3
+#define kAsioBufferSizeChange       4
+#define kAsioResyncRequest          5
+#define kAsioLatenciesChanged       6
+#define kAsioSupportsTimeInfo       7
+#define kAsioSupportsTimeCode       8
+#define kAsioOverload               15
+
 /* Future selectors */
 #define kAsioEnableTimeCodeRead     1
 #define kAsioDisableTimeCodeRead    2
@@ -316,4 +538,10 @@ enum unix_funcs {
 #define kAsioGetInternalBufferSamples 0x25042012
 #define kAsioSupportsInputResampling  0x26092017
 
+/* WineASIO future selector: ASE_SUCCESS once the background autoconnect
+ * has made the planned connections, ASE_InvalidMode while it is still
+ * working. opt may point to a LONG timeout in milliseconds to wait for it;
+ * the status block's connections_ready flag can be polled instead. */
+#define kWineAsioConnectionsReady   0x57494e45
+
 #endif /* __WINEASIO_UNIXLIB_H */
\ No newline at end of file